@@ -23,8 +23,12 @@
 #ifndef __CTGLDISPLAY_H__
 #define __CTGLDISPLAY_H__
 
+#include <deque>
+
 #include "GLDisplay.h"
 #include "lima/CtControl.h"
+#include "lima/ThreadUtils.h"
+#include "processlib/Data.h"
 
 class CtGLDisplay
 {
@@ -39,13 +43,39 @@ class CtGLDisplay
 	virtual void setTestImage(bool active) = 0;
 
 	virtual void getRates(float *update, float *refresh) = 0;
-	virtual void getNorm(unsigned long *minval, unsigned long *maxval,
+	virtual void getNorm(double *minval, double *maxval,
 			     int *autorange) = 0;
-	virtual void setNorm(unsigned long minval, unsigned long maxval,
+	virtual void setNorm(double minval, double maxval,
 			     int autorange) = 0;
+	virtual void getFrameStats(unsigned long *displayed,
+				   unsigned long *skipped,
+				   unsigned long *acquired) = 0;
+	virtual void getUploadStats(unsigned long long *uploaded,
+				    unsigned long long *saved) = 0;
+	virtual void getPacingStats(unsigned long *wakeups, float *interval,
+				    float *jitter) = 0;
 
  protected:
+	class ImageStatusCallback :
+		public lima::CtControl::ImageStatusCallback
+	{
+	public:
+		ImageStatusCallback(CtGLDisplay& ct_gl_display);
+	protected:
+		virtual void imageStatusChanged(
+			const lima::CtControl::ImageStatus& status);
+	private:
+		CtGLDisplay& m_ct_gl_display;
+	};
+	friend class ImageStatusCallback;
+
+	void registerImageStatusCallback();
+	void unregisterImageStatusCallback();
+	virtual void imageStatusChanged(
+			const lima::CtControl::ImageStatus& status);
+
 	lima::CtControl *m_ct_control;
+	ImageStatusCallback *m_img_status_cb;
 };
 
 
@@ -58,6 +88,7 @@ class CtSPSGLDisplay : public CtGLDisplay
 
 	void setSpecArray(std::string spec_name, std::string array_name);
 	void getSpecArray(std::string& spec_name, std::string& array_name);
+	void addSpecArray(std::string spec_name, std::string array_name);
 
 	virtual void createWindow();
 	virtual bool isClosed();
@@ -66,16 +97,93 @@ class CtSPSGLDisplay : public CtGLDisplay
 	virtual void setTestImage(bool active);
 
 	void setRefreshTime(float refresh_time);
+	void setZeroCopy(bool active);
+	bool getZeroCopy();
+	void setDecimateMax(bool active);
+	bool getDecimateMax();
+	void setUpdateNotify(bool active);
+	bool getUpdateNotify();
 
 	virtual void getRates(float *update, float *refresh);
-	virtual void getNorm(unsigned long *minval, unsigned long *maxval,
+	virtual void getNorm(double *minval, double *maxval,
 			     int *autorange);
-	virtual void setNorm(unsigned long minval, unsigned long maxval,
+	virtual void setNorm(double minval, double maxval,
 			     int autorange);
+	virtual void getFrameStats(unsigned long *displayed,
+				   unsigned long *skipped,
+				   unsigned long *acquired);
+	virtual void getUploadStats(unsigned long long *uploaded,
+				    unsigned long long *saved);
+	virtual void getPacingStats(unsigned long *wakeups, float *interval,
+				    float *jitter);
+
+ protected:
+	virtual void imageStatusChanged(
+			const lima::CtControl::ImageStatus& status);
 
  private:
 	SPSGLDisplayBase *m_sps_gl_display;
 	bool m_use_forked;
 };
 
+
+class CtDirectGLDisplay : public CtGLDisplay
+{
+ public:
+	CtDirectGLDisplay(lima::CtControl *ct_control,
+			  int argc = 0, char **argv = NULL);
+	virtual ~CtDirectGLDisplay();
+
+	void setCaption(std::string caption);
+
+	virtual void createWindow();
+	virtual bool isClosed();
+	virtual void closeWindow();
+	virtual void refresh();
+	virtual void setTestImage(bool active);
+
+	bool waitUpdate(float timeout);
+
+	virtual void getRates(float *update, float *refresh);
+	virtual void getNorm(double *minval, double *maxval,
+			     int *autorange);
+	virtual void setNorm(double minval, double maxval,
+			     int autorange);
+	virtual void getFrameStats(unsigned long *displayed,
+				   unsigned long *skipped,
+				   unsigned long *acquired);
+	virtual void getUploadStats(unsigned long long *uploaded,
+				    unsigned long long *saved);
+	virtual void getPacingStats(unsigned long *wakeups, float *interval,
+				    float *jitter);
+
+	void getViewSize(int *width, int *height);
+	bool getRenderedFrame(void *rgba, int width, int height);
+
+ protected:
+	virtual void imageStatusChanged(
+			const lima::CtControl::ImageStatus& status);
+
+ private:
+	typedef std::deque<Data> DataList;
+
+	GLDisplay *getGLDisplay();
+	bool checkUpdate();
+	void releasePublished();
+	void notifyUpdate();
+	static bool getPixelType(const Data& data, int& depth,
+				 GLDisplay::PixelType& type);
+
+	GLDisplay *m_gldisplay;
+	std::string m_caption;
+	int m_argc;
+	char **m_argv;
+	lima::Mutex m_mutex;
+	Data m_ready_data;
+	bool m_data_ready;
+	DataList m_published_data;
+	long m_last_frame_nb;
+	int m_notify_fd[2];
+};
+
 #endif // __CTGLDISPLAY_H__
@@ -25,6 +25,7 @@
 
 #include <string>
 #include <vector>
+#include <deque>
 
 #include "lima/SimplePipe.h"
 #include "lima/AutoObj.h"
@@ -35,24 +36,44 @@ class ImageLib;
 class GLDisplay
 {
  public:
+	enum PixelType {
+		Unsigned,
+		Signed,
+		Float,
+	};
+
 	GLDisplay(int argc, char **argv);
 	~GLDisplay();
 
 	void createWindow(std::string caption);
 	bool isClosed();
 
-	void setBuffer(void *buffer_ptr, int width, int height, int depth);
-	void updateBuffer();
+	void setBuffer(void *buffer_ptr, int width, int height, int depth,
+		       PixelType type = Unsigned);
+	void updateBuffer(long frame_nb = -1);
+
+	void publishBuffer(void *buffer_ptr, int width, int height,
+			   int depth, PixelType type = Unsigned);
+	bool reclaimBuffer(void *& buffer_ptr);
 
 	void setTestImage(bool active);
 
 	void refresh();
+	bool waitEvents(int fd, float timeout);
 
 	void getRates(float *update, float *refresh);
-	void getNorm(unsigned long *minval, unsigned long *maxval,
+	void getFrameStats(unsigned long *displayed, unsigned long *skipped,
+			   unsigned long *acquired);
+	void getUploadStats(unsigned long long *uploaded,
+			    unsigned long long *saved);
+	void getPacingStats(unsigned long *wakeups, float *interval,
+			    float *jitter);
+	void getNorm(double *minval, double *maxval,
 		     int *autorange);
-	void setNorm(unsigned long minval, unsigned long maxval,
+	void setNorm(double minval, double maxval,
 		     int autorange);
+	void getViewSize(int *width, int *height);
+	bool getRenderedFrame(void *rgba, int width, int height);
 
 	static void Sleep(float sleep_time);
 
@@ -70,7 +91,7 @@ class GLDisplay
 class SPSGLDisplayBase
 {
  public:
-	SPSGLDisplayBase(int argc, char **argv);
+	SPSGLDisplayBase(int argc, char **argv, bool notify_pipe = true);
 	virtual ~SPSGLDisplayBase();
 
 	void setSpecArray(std::string spec_name, std::string array_name);
@@ -78,6 +99,17 @@ class SPSGLDisplayBase
 
 	void setCaption(std::string caption);
 
+	virtual void setZeroCopy(bool active);
+	bool getZeroCopy();
+
+	virtual void setDecimateMax(bool active);
+	bool getDecimateMax();
+
+	virtual void setUpdateNotify(bool active);
+	bool getUpdateNotify();
+	void notifyUpdate();
+	bool waitUpdate(float timeout);
+
 	virtual void createWindow() = 0;
 	virtual bool isClosed() = 0;
 
@@ -86,34 +118,75 @@ class SPSGLDisplayBase
 	virtual void refresh() = 0;
 
 	virtual void getRates(float *update, float *refresh) = 0;
-	virtual void getNorm(unsigned long *minval, unsigned long *maxval,
+	virtual void getNorm(double *minval, double *maxval,
 			     int *autorange) = 0;
-	virtual void setNorm(unsigned long minval, unsigned long maxval,
+	virtual void setNorm(double minval, double maxval,
 			     int autorange) = 0;
+	virtual void getFrameStats(unsigned long *displayed,
+				   unsigned long *skipped,
+				   unsigned long *acquired) = 0;
+	virtual void getUploadStats(unsigned long long *uploaded,
+				    unsigned long long *saved) = 0;
+	virtual void getPacingStats(unsigned long *wakeups, float *interval,
+				    float *jitter) = 0;
 
  protected:
+	struct Buffer {
+		void *ptr;
+		bool attached;
+		int size;
+		Buffer(void *p = NULL, bool a = false, int s = 0)
+			: ptr(p), attached(a), size(s) {}
+	};
+	typedef std::deque<Buffer> BufferList;
+
 	bool checkSpecArray();
+	bool checkFrameTorn();
 	void releaseBuffer();
+	int getViewStep(int cols, int rows);
+	void getBufferDim(int& width, int& height);
+	int getCopySize();
+	void copyData();
+	void decimateData(void *dst_ptr);
+	void publishBuffer(const Buffer& buffer);
+	void reclaimBuffers();
+	void freeBuffer(const Buffer& buffer);
+	void freeSpareBuffers();
 
 	std::string m_spec_name;
 	std::string m_array_name;
 	void *m_buffer_ptr;
+	BufferList m_published;
+	std::vector<void *> m_spare_buffers;
 	int m_width;
 	int m_height;
 	int m_depth;
+	GLDisplay::PixelType m_type;
+	int m_step;
+	void *m_src_ptr;
+	bool m_zero_copy;
+	bool m_decimate_max;
+	int m_update_counter;
+	unsigned long m_torn_frames;
+	bool m_update_notify;
+	int m_notify_fd[2];
 	GLDisplay *m_gldisplay;
 	std::string m_caption;
 
 	enum {
 		SPS_NrTypes = 11,
 	};
-	static const int SPS_TypeDepth[SPS_NrTypes];
+	struct SPSTypeInfo {
+		int depth;
+		GLDisplay::PixelType type;
+	};
+	static const SPSTypeInfo SPS_TypeInfo[SPS_NrTypes];
 };
 
 class LocalSPSGLDisplay : public SPSGLDisplayBase
 {
  public:
-	LocalSPSGLDisplay(int argc, char **argv);
+	LocalSPSGLDisplay(int argc, char **argv, bool notify_pipe = true);
 	virtual ~LocalSPSGLDisplay();
 
 	virtual void createWindow();
@@ -124,10 +197,20 @@ class LocalSPSGLDisplay : public SPSGLDisplayBase
 	virtual void refresh();
 
 	virtual void getRates(float *update, float *refresh);
-	virtual void getNorm(unsigned long *minval, unsigned long *maxval,
+	virtual void getNorm(double *minval, double *maxval,
 			     int *autorange);
-	virtual void setNorm(unsigned long minval, unsigned long maxval,
+	virtual void setNorm(double minval, double maxval,
 			     int autorange);
+	virtual void getFrameStats(unsigned long *displayed,
+				   unsigned long *skipped,
+				   unsigned long *acquired);
+	virtual void getUploadStats(unsigned long long *uploaded,
+				    unsigned long long *saved);
+	virtual void getPacingStats(unsigned long *wakeups, float *interval,
+				    float *jitter);
+
+	bool checkUpdate();
+	bool checkTorn();
 
  private:
 };
@@ -148,15 +231,35 @@ class ForkedSPSGLDisplay : public SPSGLDisplayBase
 	virtual void refresh();
 
 	virtual void getRates(float *update, float *refresh);
-	virtual void getNorm(unsigned long *minval, unsigned long *maxval,
+	virtual void getNorm(double *minval, double *maxval,
 			     int *autorange);
-	virtual void setNorm(unsigned long minval, unsigned long maxval,
+	virtual void setNorm(double minval, double maxval,
 			     int autorange);
+	virtual void getFrameStats(unsigned long *displayed,
+				   unsigned long *skipped,
+				   unsigned long *acquired);
+	virtual void getUploadStats(unsigned long long *uploaded,
+				    unsigned long long *saved);
+	virtual void getPacingStats(unsigned long *wakeups, float *interval,
+				    float *jitter);
+
+	virtual void setZeroCopy(bool active);
+	virtual void setDecimateMax(bool active);
+	virtual void setUpdateNotify(bool active);
 
 	void setRefreshTime(float refresh_time);
 
+	void addSpecArray(std::string spec_name, std::string array_name);
+
  private:
+	typedef std::pair<std::string, std::string> SpecArray;
+	typedef std::vector<SpecArray> SpecArrayList;
+	typedef std::vector<LocalSPSGLDisplay *> LocalDisplayList;
+
 	void runChild();
+	void createExtraDisplays();
+	bool checkExtraDisplays();
+	void deleteExtraDisplays();
 	bool checkParentAlive();
 
 	std::string sendChildCmd(std::string cmd);
@@ -169,9 +272,14 @@ class ForkedSPSGLDisplay : public SPSGLDisplayBase
 	lima::AutoPtr<Pipe> m_res_pipe;
 	bool m_child_ended;
 	float m_refresh_time;
+	SpecArrayList m_extra_arrays;
+	LocalDisplayList m_extra_displays;
+	int m_argc;
+	char **m_argv;
 
 	static const float ParentCheckTime;
 	static const float DefaultRefreshTime;
+	static const int DoublePrecision;
 
 	enum {
 		CmdQuit,
@@ -180,6 +288,12 @@ class ForkedSPSGLDisplay : public SPSGLDisplayBase
 		CmdGetNorm,
 		CmdSetNorm,
 		CmdSetRefreshTime,
+		CmdSetZeroCopy,
+		CmdSetUpdateNotify,
+		CmdSetDecimateMax,
+		CmdGetFrameStats,
+		CmdGetUploadStats,
+		CmdGetPacingStats,
 		NrCmd,
 	};
 	static const std::string CmdList[NrCmd];
@@ -0,0 +1,119 @@
+//###########################################################################
+// This file is part of gldisplay, a submodule of LImA project the
+// Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#ifndef __FRAME_RING_H
+#define __FRAME_RING_H
+
+#include <deque>
+
+/********************************************************************
+ * FrameRing
+ *
+ * Single-producer/single-consumer exchange of frame buffers, without
+ * lock (triple buffering). A published frame replaces the one not
+ * taken yet, so publishing never fails. The consumer takes the newest
+ * frame and keeps it until it takes another one. The replaced and the
+ * no longer used frames are handed back to the producer by reclaim,
+ * not in publication order. Data holds the frame in its buffer member
+ ********************************************************************/
+
+template <class Data>
+class FrameRing
+{
+public:
+	FrameRing()
+		: middle(1), back(2), front(0)
+	{
+		for (int i = 0; i < NrSlots; ++i)
+			used[i] = false;
+	}
+
+	// producer side
+	void publish(const Data& data)
+	{
+		slot[back] = data;
+		used[back] = true;
+		// replaced before being taken, or released by the consumer
+		back = exchange(back | Fresh) & SlotMask;
+		retire();
+	}
+
+	bool reclaim(void *& buffer)
+	{
+		// the consumer only exchanges a Fresh slot: a frame it has
+		// released can be got back without publishing
+		if (!(load() & Fresh)) {
+			back = exchange(back) & SlotMask;
+			retire();
+		}
+		if (retired.empty())
+			return false;
+		buffer = retired.front();
+		retired.pop_front();
+		return true;
+	}
+
+	// consumer side
+	bool takeNewest(Data& data)
+	{
+		// only the consumer clears Fresh
+		if (!(load() & Fresh))
+			return false;
+		front = exchange(front) & SlotMask;
+		data = slot[front];
+		return true;
+	}
+
+private:
+	enum { NrSlots = 3, SlotMask = 3, Fresh = 4 };
+
+	void retire()
+	{
+		if (used[back])
+			retired.push_back(slot[back].buffer);
+		used[back] = false;
+	}
+
+	int load()
+	{
+		return __sync_fetch_and_add(&middle, 0);
+	}
+
+	// full barrier: the slot is written before it is exchanged
+	int exchange(int val)
+	{
+		int old;
+		do {
+			old = load();
+		} while (!__sync_bool_compare_and_swap(&middle, old, val));
+		return old;
+	}
+
+	Data slot[NrSlots];
+	bool used[NrSlots];		// producer only
+	volatile int middle;		// slot exchanged, Fresh if not taken
+	int back;			// producer only
+	int front;			// consumer only
+	std::deque<void *> retired;	// producer only
+};
+
+#endif // __FRAME_RING_H
@@ -30,10 +30,14 @@
 #include <QMutex>
 #include <QtOpenGL>
 #include <X11/Xutil.h>
+#include <X11/extensions/XShm.h>
 #include <pthread.h>
+#include <vector>
 
 #include "prectime.h"
 #include "autoobj.h"
+#include "imageproc.h"
+#include "framering.h"
 
 
 typedef AutoLock<QMutex> Lock;
@@ -60,21 +64,53 @@ protected:
 class ImagePixelPtr
 {
 public:
+	enum Type {
+		Unsigned,
+		Signed,
+		Float,
+	};
+
 	union Ptr {
 		unsigned char  *c;
 		unsigned short *s;
 		unsigned int   *i;
 		unsigned long  *l;
+		signed char    *sc;
+		short          *ss;
+		int            *si;
+		float          *f;
+		double         *d;
 		void           *v;
 	};
 
 	ImagePixelPtr() { init(NULL, 0); }
-	ImagePixelPtr(void *p, unsigned dpth) { init(p, dpth); }
+	ImagePixelPtr(void *p, unsigned dpth, Type tp = Unsigned) 
+	{ init(p, dpth, tp); }
 	template <class T>
 	ImagePixelPtr(T *p) { init(p, sizeof(T)); }
+	ImagePixelPtr(signed char *p) { init(p, sizeof(*p), Signed); }
+	ImagePixelPtr(short *p) { init(p, sizeof(*p), Signed); }
+	ImagePixelPtr(int *p) { init(p, sizeof(*p), Signed); }
+	ImagePixelPtr(float *p) { init(p, sizeof(float), Float); }
+	ImagePixelPtr(double *p) { init(p, sizeof(double), Float); }
 
-	unsigned operator *()
+	double operator *()
 	{
+		if (t == Float) {
+			switch (d) {
+			case 4: return *ptr.f;
+			case 8: return *ptr.d;
+			}
+			return 0;
+		} else if (t == Signed) {
+			switch (d) {
+			case 1: return *ptr.sc;
+			case 2: return *ptr.ss;
+			case 4: return *ptr.si;
+			}
+			return 0;
+		}
+
 		switch (d) {
 		case 1: return *ptr.c;
 		case 2: return *ptr.s;
@@ -83,12 +119,27 @@ public:
 		return 0;
 	}
 
-	unsigned store(unsigned val)
+	double store(double val)
 	{
+		if (t == Float) {
+			switch (d) {
+			case 4: return *ptr.f = val;
+			case 8: return *ptr.d = val;
+			}
+			return 0;
+		} else if (t == Signed) {
+			switch (d) {
+			case 1: return *ptr.sc = (int) val;
+			case 2: return *ptr.ss = (int) val;
+			case 4: return *ptr.si = (int) val;
+			}
+			return 0;
+		}
+
 		switch (d) {
-		case 1: return *ptr.c = val;
-		case 2: return *ptr.s = val;
-		case 4: return *ptr.i = val;
+		case 1: return *ptr.c = (unsigned) val;
+		case 2: return *ptr.s = (unsigned) val;
+		case 4: return *ptr.i = (unsigned) val;
 		}
 		return 0;
 	}
@@ -102,18 +153,26 @@ public:
 	{ return ptr.s; }
 	unsigned int   *iPtr()
 	{ return ptr.i; }
+	float          *fPtr()
+	{ return ptr.f; }
+	double         *dPtr()
+	{ return ptr.d; }
 	void           *vPtr()
 	{ return ptr.v; }
 
-	void init(void *p, unsigned dpth)
-	{ ptr.v = p; d = dpth; }
+	void init(void *p, unsigned dpth, Type tp = Unsigned)
+	{ ptr.v = p; d = dpth; t = tp; }
 
 	unsigned long depth()
 	{ return d; }
 
+	Type type()
+	{ return t; }
+
 private:
 	Ptr ptr;
 	unsigned long d;
+	Type t;
 };
 
 
@@ -125,17 +184,41 @@ class Image : public QObject
 {
 public:
 	Image();
-	Image(void *ptr, unsigned width, unsigned height, unsigned depth);
+	Image(void *ptr, unsigned width, unsigned height, unsigned depth,
+	      ImagePixelPtr::Type type = ImagePixelPtr::Unsigned);
 	
 	bool isValid()
 	{ return buff.vPtr() && buff.depth() && w && h; }
 
 	void setBuffer(void *ptr, unsigned width, unsigned height, 
-		       unsigned depth);
+		       unsigned depth, 
+		       ImagePixelPtr::Type type = ImagePixelPtr::Unsigned);
 	void setTestImage(bool active);
 
-	unsigned maxVal()
-	{ return (1ULL << (8 * buff.depth())) - 1; }
+	bool getMinMax(double& min_val, double& max_val);
+	bool getHistogram(ImageHistogram& hist, unsigned long nr_samples = 0);
+	void convert(unsigned short *dst, double min_val, double max_val);
+	void convert(unsigned short *dst, double min_val, double max_val,
+		     int x, int y, int width, int height);
+	void colormap(double min_val, double max_val, const unsigned int *lut,
+		      unsigned int *dst, int dst_width, int dst_height,
+		      int dst_stride);
+	void reduce(int x, int y, int width, int height, bool use_max,
+		    Image& dst);
+
+	bool isFloat()
+	{ return buff.type() == ImagePixelPtr::Float; }
+	bool isSigned()
+	{ return buff.type() == ImagePixelPtr::Signed; }
+
+	// float images are expected in [0, 1]
+	double maxVal()
+	{ 
+		if (isFloat())
+			return 1.0;
+		int bits = 8 * depth() - (isSigned() ? 1 : 0);
+		return double((1ULL << bits) - 1); 
+	}
 
 	ImagePixelPtr ptr()
 	{ return buff; }
@@ -147,6 +230,8 @@ public:
 	{ return w * h; }
 	unsigned depth()
 	{ return buff.depth(); }
+	ImagePixelPtr::Type type()
+	{ return buff.type(); }
 	unsigned size()
 	{ return nrPixels() * depth(); }
 
@@ -173,33 +258,87 @@ public:
 		Unknown,
 	};
 
+	enum RenderMode {
+		DrawPixels,
+		Texture,
+		Shader,
+		Software,
+		Remote,
+	};
+
+	enum AutoRangeMode {
+		AutoMinMax,
+		AutoPercentile,
+		AutoSampled,
+	};
+
 	ImageWidget(QWidget *parent = NULL, ColormapType cmap = Grayscale);
 	~ImageWidget();
 
 	int setBuffer(void *buffer, int width, int height, int depth,
+		      ImagePixelPtr::Type type = ImagePixelPtr::Unsigned,
 		      bool do_update = true);
 
 	static QString colormapName(ColormapType cmap);
 	static ColormapType colormapType(QString name);
 
+	void getViewSize(int *width, int *height);
+	void getUploadStats(unsigned long long *uploaded,
+			    unsigned long long *saved);
+	const ImageHistogram& getHistogram();
+
+	void setOffscreen(int width, int height);
+	bool getRenderedFrame(void *rgba, int width, int height);
+	void requestUpdate();
+
 public slots:
 	void setTestImage(bool test_active);
 	void setColormap(ColormapType cmap);
 	void updateImage(bool force_norm = false);
 	void normalize(bool force = false); 
-	void getNorm(unsigned long *minval, unsigned long *maxval, 
-		     int *autorange);
-	void setNorm(unsigned long minval, unsigned long maxval, 
-		     int autorange);
+	void getNorm(double *minval, double *maxval, int *autorange);
+	void setNorm(double minval, double maxval, int autorange);
 
 protected:
 	void initializeGL();
 	void resizeGL(int width, int height);
 	void paintGL();
+	void glDraw();
+	void readRenderedFrame();
+	void drawSoftware();
+	bool allocSoftImage(int width, int height);
+	bool createShmImage(Visual *visual, int depth, int width, int height);
+	void freeSoftImage();
+	void setSoftwareColormap(float map[][4], int size);
+	void drawRemote(Image& image);
+	void setRemoteColormap(float map[][4], int size);
 
 	void calcResize();
 	void reallocTestImage();
+	void reallocDispImage();
 	Image& getActiveImage();
+	Image& getDrawImage();
+
+	void getTextureFormat(Image& draw_image, GLint& format,
+			      GLenum& data_format, GLenum& type);
+	void reallocTiles(Image& draw_image, GLint format, int level);
+	void deleteTiles();
+	void setTilesDirty();
+	void updateTiles(Image& image, Image& draw_image);
+	int uploadTiles(Image& draw_image);
+	void drawTiles(Image& draw_image);
+	int pyramidLevel(Image& draw_image);
+	void reallocPyramid(Image& draw_image, int nr_levels);
+	void deletePyramid();
+	void initPixelBuffers();
+	const void *fillPixelBuffer(Image& draw_image, int& row, 
+				    int nr_rows);
+	bool initShader();
+	GLint rawTextureFormat(Image& draw_image);
+	void setShaderNorm(Image& image);
+	void setShaderColormap(float map[][4], int size);
+
+	static bool hasGLExtension(const char *ext);
 
 	int  checkColorTableColormap(float map[][4], int size);
 	void setColorTableColormap(float map[][4], int size);
@@ -208,15 +347,42 @@ protected:
 	void setX11Colormap(float map[][4], int size);
 
 private:
+	// part of the image in its own texture
+	struct Tile {
+		GLuint texture;
+		GLint x, y;
+		GLsizei width, height;
+		GLsizei tex_width, tex_height;
+		GLboolean dirty;
+		GLboolean loaded;
+		unsigned long long hash;
+		GLboolean hashed;
+	};
+
+	void tileRect(Tile& tile, Image& draw_image, int& tx, int& ty,
+		      int& width, int& height);
+	void reduceTile(Tile& tile, Image& draw_image);
+	void compareTiles(Image& image, Image& draw_image);
+	void convertTiles(Image& image);
+	static unsigned long long tileBytes(Tile& tile, Image& draw_image);
+
 	Image realimage;
 	Image testimage;
+	Image dispimage;
 	GLboolean test_active;
 	GLenum b_type;
 	GLsizei w_width, w_height;
 	GLint x, y;
 	GLfloat factor;
-	GLuint min_val, max_val;
+	GLdouble min_val, max_val;
 	GLint auto_range;
+	AutoRangeMode auto_range_mode;
+	double low_percentile, high_percentile;
+	ImageHistogram histogram;
+	GLboolean hist_valid;
+	enum { DefaultNrSamples = 65536 };
+	unsigned long nr_samples;
+	ImageHistogram sample_hist;
 	Rate normalize_rate;
 	ColormapType colormap;
 	GLint mapsize;
@@ -224,46 +390,87 @@ private:
 	Colormap x11colormap;
 	unsigned long *x11cmap;
 	GLint draw_mode;
+	RenderMode render_mode;
+	enum { DefaultTileSize = 512 };
+	std::vector<Tile> tiles;
+	GLsizei tiles_width, tiles_height;
+	GLint tiles_format;
+	GLint tiles_level;
+	enum { MaxPyramidLevels = 16 };
+	GLboolean use_pyramid, pyramid_max;
+	std::vector<Image *> pyramid;
+	GLsizei tile_size;
+	GLint max_tile_uploads;
+	GLboolean dirty_tiles;
+	unsigned long long upload_bytes;
+	unsigned long long saved_bytes;
+	GLdouble conv_min, conv_max;
+	GLboolean conv_valid;
+	GLfloat pt_scale, pt_offset;
+	GLboolean offscreen;
+	GLsizei offscreen_width, offscreen_height;
+	GLboolean offscreen_init;
+	QGLFramebufferObject *fbo;
+	unsigned char *rendered_frame;
+	GLsizei rendered_width, rendered_height;
+	GLboolean render_mode_auto;
+	XImage *soft_image;
+	GC soft_gc;
+	GLboolean soft_use_shm;
+	XShmSegmentInfo soft_shminfo;
+	GLint soft_x, soft_y;
+	unsigned int soft_lut[256];
+	GLenum remote_format;
+	std::vector<unsigned int> remote_buffer;
+	std::vector<unsigned char> remote_pixels;
+	GLuint program;
+	GLint program_scale, program_offset;
+	GLfloat shader_scale, shader_offset;
+	GLuint cmap_texture;
+	enum { MaxPixelBuffers = 3 };
+	GLint nr_pbo;
+	GLint pbo_index;
+	GLuint pbo[MaxPixelBuffers];
+	GLsizeiptr pbo_size[MaxPixelBuffers];
+	GLboolean must_upload;
 	GLboolean must_normalize;
 	GLboolean must_resize;
+	GLboolean must_convert;
+	GLboolean must_compare;
+};
+
+
+/********************************************************************
+ * BufferData
+ *
+ * A frame exchanged through the ImageWindow FrameRing
+ ********************************************************************/
+
+struct BufferData {
+	void *buffer;
+	int width, height, depth;
+	ImagePixelPtr::Type type;
+	BufferData() :
+		buffer(NULL), width(0), height(0), depth(0),
+		type(ImagePixelPtr::Unsigned) {}
+	BufferData(void *b, int w, int h, int d, ImagePixelPtr::Type t) :
+		buffer(b), width(w), height(h), depth(d), type(t) {}
 };
 
 
 /********************************************************************
- * ImageEvent / SetBufferEvent / UpdateEvent
+ * ImageEvent / UpdateEvent
  ********************************************************************/
 
 class ImageEvent : public QEvent
 {
 public:
-	enum { SetBuffer = User + 1, Update };
+	enum { Update = User + 1 };
 
 	ImageEvent(int type) : 
 		QEvent(QEvent::Type(type)) {}
 };
 
-class SetBufferEvent : public ImageEvent
-{
-public:
-	struct BufferData {
-		void *buffer;
-		int width, height, depth;
-		BufferData(void *b, int w, int h, int d) :
-			buffer(b), width(w), height(h), depth(d) {}
-	};
-
-	SetBufferEvent(void *b, int w, int h, int d) :
-		ImageEvent(SetBuffer), buff_data(b, w, h, d) 
-	{}
-
-
-	BufferData *bufferData()
-	{	return &buff_data;	}
-
-private:
-	BufferData buff_data;
-};
-
 class UpdateEvent : public ImageEvent
 {
  public:
@@ -287,17 +494,29 @@ public:
 	ImageWindow(QString caption);
 	~ImageWindow();
 
-	int setBuffer(void *buffer, int width, int height, int depth);
+	int setBuffer(void *buffer, int width, int height, int depth,
+		      ImagePixelPtr::Type type = ImagePixelPtr::Unsigned);
+	void publishBuffer(void *buffer, int width, int height, int depth,
+			   ImagePixelPtr::Type type = ImagePixelPtr::Unsigned);
+	bool reclaimBuffer(void *& buffer);
 	void setColormap(ImageWidget::ColormapType colormap);
 	
 	void closeEvent(QCloseEvent *event);
 	void setCloseCB(closeCB cb, void *cb_data);
 
 	void getRates(float *update, float *refresh);
-	void getNorm(unsigned long *minval, unsigned long *maxval, 
-		     int *autorange);
-	void setNorm(unsigned long minval, unsigned long maxval, 
-		     int autorange);
+	void getNorm(double *minval, double *maxval, int *autorange);
+	void setNorm(double minval, double maxval, int autorange);
+	void getViewSize(int *width, int *height);
+	bool getRenderedFrame(void *rgba, int width, int height);
+
+	void setFrameNb(long frame_nb);
+	void getFrameStats(unsigned long *displayed, unsigned long *skipped,
+			   unsigned long *acquired);
+	void getUploadStats(unsigned long long *uploaded,
+			    unsigned long long *saved);
+	void getPacingStats(unsigned long *wakeups, float *interval,
+			    float *jitter);
 
 	ImageWidget *imageWidget()
 	{ return image; }
@@ -305,6 +524,8 @@ public:
 	bool isRelaxed()
 	{ return relaxed; }
 
+	float pendingTime();
+
 public slots:
 	void update(bool just_update);
 
@@ -314,23 +535,36 @@ signals:
 protected:
 	int startTimer(int msec);
 	void timerEvent(QTimerEvent *event);
+	void scheduleRefresh();
+	void postUpdate();
 	void customEvent(QEvent *event);
 
 	void realUpdate();
 	int realSetBuffer(void *buffer, int width, int height, 
-			  int depth);
+			  int depth, ImagePixelPtr::Type type);
 
-	SetBufferEvent *checkBufferEvent();
+	void newFrame(long frame_nb);
+	void frameDisplayed();
 
 private:
 	ImageWidget *image;
 
 	int timer_id;
 	volatile bool relaxed;
+	bool pending_update;	// arrived during the refresh period
 	Rate update_rate, refresh_rate, calc_rate, *max_refresh_rate;
 
+	FrameRing<BufferData> frame_ring;
 	QMutex buffer_mutex;
-	SetBufferEvent *buffer_event;
+
+	long frame_nb, disp_frame_nb;
+	bool explicit_frame_nb;
+	unsigned long disp_frames, skip_frames, acq_frames;
+
+	unsigned long nr_wakeups;
+	PrecTime last_display;
+	unsigned long nr_intervals;
+	double interval_sum, interval_sum2;
 		
 	closeCB close_cb;
 	void *close_cb_data;
@@ -356,7 +590,8 @@ public:
 
 	ImageWindow *createImage(QString caption);
 	int setImageBuffer(ImageWindow *win, void *buffer, 
-			   int width, int height, int depth);
+			   int width, int height, int depth,
+			   ImagePixelPtr::Type type = ImagePixelPtr::Unsigned);
 	void destroyImage(ImageWindow *win);
 	int setImageCloseCB(ImageWindow *win,
 			    ImageWindow::closeCB cb, void *data);
@@ -365,11 +600,22 @@ public:
 	void setTestImage(ImageWindow *win, bool test_active);
 	int poll();
 
+	int xConnectionFd();
+	float eventTimeout(float timeout);
+
 	void getImageRates(ImageWindow *win, float *update, float *refresh);
-	void getImageNorm(ImageWindow *win, unsigned long *minval, 
-			  unsigned long *maxval, int *autorange);
-	void setImageNorm(ImageWindow *win, unsigned long minval, 
-			  unsigned long maxval, int autorange);
+	void getImageNorm(ImageWindow *win, double *minval, 
+			  double *maxval, int *autorange);
+	void setImageNorm(ImageWindow *win, double minval, 
+			  double maxval, int autorange);
+	void getImageFrameStats(ImageWindow *win, unsigned long *displayed,
+				unsigned long *skipped, 
+				unsigned long *acquired);
+	void getImageUploadStats(ImageWindow *win, 
+				 unsigned long long *uploaded,
+				 unsigned long long *saved);
+	void getImagePacingStats(ImageWindow *win, unsigned long *wakeups,
+				 float *interval, float *jitter);
 
 private:
 	ImageWidget::ColormapType colormap;
@@ -420,19 +666,30 @@ public:
 	void destroyImage(ImageWindow *win);
 
 	int poll();
+	int waitEvents(int fd, float timeout);
 
 	int setImageBuffer(ImageWindow *win, void *buffer, 
-			   int width, int height, int depth);
+			   int width, int height, int depth,
+			   ImagePixelPtr::Type type = ImagePixelPtr::Unsigned);
 	void setTestImage(ImageWindow *win, int test_active);
 	int setImageCloseCB(ImageWindow *win,
 			    ImageWindow::closeCB cb, void *data);
 	void updateImage(ImageWindow *win);
 
 	void getImageRates(ImageWindow *win, float *update, float *refresh);
-	void getImageNorm(ImageWindow *win, unsigned long *minval, 
-			  unsigned long *maxval, int *autorange);
-	void setImageNorm(ImageWindow *win, unsigned long minval, 
-			  unsigned long maxval, int autorange);
+	void getImageNorm(ImageWindow *win, double *minval, 
+			  double *maxval, int *autorange);
+	void setImageNorm(ImageWindow *win, double minval, 
+			  double maxval, int autorange);
+	void setImageFrameNb(ImageWindow *win, long frame_nb);
+	void getImageFrameStats(ImageWindow *win, unsigned long *displayed,
+				unsigned long *skipped, 
+				unsigned long *acquired);
+	void getImageUploadStats(ImageWindow *win, 
+				 unsigned long long *uploaded,
+				 unsigned long long *saved);
+	void getImagePacingStats(ImageWindow *win, unsigned long *wakeups,
+				 float *interval, float *jitter);
 
 protected:
 	enum ImageOp { 
@@ -465,7 +722,7 @@ private:
 	ImageOp img_op_requested;
 	QString img_op_caption;
 	ImageWindow *img_op_win;
-	unsigned long img_op_norm[3];
+	double img_op_norm[3];
 	QWaitCondition img_op_done;
 	ImageApplication *app;
 };
@@ -45,10 +45,17 @@ void image_update(image_t img);
 int image_set_test(image_t img, int active);
 
 void image_get_rates(image_t img, float *update, float *refresh);
-void image_get_norm(image_t img, unsigned long *min_val, 
-		    unsigned long *max_val, int *auto_range);
-void image_set_norm(image_t img, unsigned long min_val, 
-		    unsigned long max_val, int auto_range);
+void image_set_frame_nb(image_t img, long frame_nb);
+void image_get_frame_stats(image_t img, unsigned long *displayed,
+			   unsigned long *skipped, unsigned long *acquired);
+void image_get_upload_stats(image_t img, unsigned long long *uploaded,
+			    unsigned long long *saved);
+void image_get_pacing_stats(image_t img, unsigned long *wakeups,
+			    float *interval, float *jitter);
+void image_get_norm(image_t img, double *min_val, 
+		    double *max_val, int *auto_range);
+void image_set_norm(image_t img, double min_val, 
+		    double max_val, int auto_range);
 
 int image_poll(void);
 
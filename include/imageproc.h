@@ -0,0 +1,242 @@
+//###########################################################################
+// This file is part of gldisplay, a submodule of LImA project the
+// Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#ifndef __IMAGEPROC_H
+#define __IMAGEPROC_H
+
+#include <vector>
+
+/********************************************************************
+ * Pixel kernels
+ *
+ * Per-type statistics and conversion loops used by the display.
+ * They do not depend on Qt/OpenGL.
+ ********************************************************************/
+
+// Min/max of the pixels. Returns false if the image is empty
+bool imageMinMax(const unsigned char *ptr, unsigned long len,
+		 double& min_val, double& max_val);
+bool imageMinMax(const unsigned short *ptr, unsigned long len,
+		 double& min_val, double& max_val);
+bool imageMinMax(const unsigned int *ptr, unsigned long len,
+		 double& min_val, double& max_val);
+bool imageMinMax(const signed char *ptr, unsigned long len,
+		 double& min_val, double& max_val);
+bool imageMinMax(const short *ptr, unsigned long len,
+		 double& min_val, double& max_val);
+bool imageMinMax(const int *ptr, unsigned long len,
+		 double& min_val, double& max_val);
+
+// Min/max of the finite pixels (NaN/Inf are masked).
+// Returns false if there is no finite pixel
+bool imageMinMax(const float *ptr, unsigned long len,
+		 double& min_val, double& max_val);
+bool imageMinMax(const double *ptr, unsigned long len,
+		 double& min_val, double& max_val);
+
+// Highest instruction set the integer kernels may use. They pick the
+// best one the CPU supports at run time; lowering it is for tests and
+// benchmarks. Returns the level actually used
+enum { ImageSimdNone, ImageSimdSse2, ImageSimdAvx2 };
+
+int imageSetSimd(int max_level);
+
+// Maximum number of threads sharing the work on large frames, including
+// the calling one. 0 (default) leaves half of the CPUs to the
+// acquisition. Returns the number actually used
+int imageSetThreads(int nr_threads);
+
+// Scale [min_val, max_val] into [0, ImageDisplayMax], clipping outside
+// values. NaN/Inf pixels are shown as min_val
+enum { ImageDisplayMax = 65535 };
+
+void imageConvert(const float *src, unsigned long len,
+		  double min_val, double max_val, unsigned short *dst);
+void imageConvert(const double *src, unsigned long len,
+		  double min_val, double max_val, unsigned short *dst);
+
+// Histogram of the finite pixels: bins[i] counts the values in
+// [first_val + i * bin_width, first_val + (i + 1) * bin_width). 8 and
+// 16-bit pixels, and 32-bit ones of narrow range, get one bin per value
+// (exact). Otherwise ImageHistBins bins cover [min_val, max_val].
+// Returns false if there is no finite pixel
+enum { ImageHistBins = 65536 };
+
+struct ImageHistogram {
+	double first_val, bin_width;
+	double min_val, max_val;
+	unsigned long nr_pixels;
+	bool exact;
+	std::vector<unsigned long> bins;
+};
+
+bool imageHistogram(const unsigned char *ptr, unsigned long len,
+		    ImageHistogram& hist);
+bool imageHistogram(const unsigned short *ptr, unsigned long len,
+		    ImageHistogram& hist);
+bool imageHistogram(const unsigned int *ptr, unsigned long len,
+		    ImageHistogram& hist);
+bool imageHistogram(const signed char *ptr, unsigned long len,
+		    ImageHistogram& hist);
+bool imageHistogram(const short *ptr, unsigned long len,
+		    ImageHistogram& hist);
+bool imageHistogram(const int *ptr, unsigned long len,
+		    ImageHistogram& hist);
+bool imageHistogram(const float *ptr, unsigned long len,
+		    ImageHistogram& hist);
+bool imageHistogram(const double *ptr, unsigned long len,
+		    ImageHistogram& hist);
+
+// Value below which fraction (in [0, 1]) of the pixels lie, interpolated
+// inside the bin unless exact. 0 and 1 give the min and max
+double imageHistPercentile(const ImageHistogram& hist, double fraction);
+
+// Histogram of nr_samples pixels, or of the whole frame if it is not
+// larger: one pixel at a pseudo-random offset in each of nr_samples
+// equal runs, so that the sampling does not alias with the rows. The
+// offsets are the same for each frame. min_val/max_val are those of
+// the samples
+bool imageSampleHistogram(const unsigned char *ptr, unsigned long len,
+			  unsigned long nr_samples, ImageHistogram& hist);
+bool imageSampleHistogram(const unsigned short *ptr, unsigned long len,
+			  unsigned long nr_samples, ImageHistogram& hist);
+bool imageSampleHistogram(const unsigned int *ptr, unsigned long len,
+			  unsigned long nr_samples, ImageHistogram& hist);
+bool imageSampleHistogram(const signed char *ptr, unsigned long len,
+			  unsigned long nr_samples, ImageHistogram& hist);
+bool imageSampleHistogram(const short *ptr, unsigned long len,
+			  unsigned long nr_samples, ImageHistogram& hist);
+bool imageSampleHistogram(const int *ptr, unsigned long len,
+			  unsigned long nr_samples, ImageHistogram& hist);
+bool imageSampleHistogram(const float *ptr, unsigned long len,
+			  unsigned long nr_samples, ImageHistogram& hist);
+bool imageSampleHistogram(const double *ptr, unsigned long len,
+			  unsigned long nr_samples, ImageHistogram& hist);
+
+// Bound on the error of the percentile fractions estimated from
+// nr_samples random pixels, with a 99% confidence (Dvoretzky-Kiefer-
+// Wolfowitz). 0.0064 for 65536 samples
+double imageSampleError(unsigned long nr_samples);
+
+// Copy one pixel out of step in each direction, of any depth (1, 2, 4
+// or 8 bytes), starting with the first one. dst is ((width + step - 1) 
+// / step) x ((height + step - 1) / step) pixels, like imageDecimateMax
+void imageSubsample(const void *src, int width, int height, int depth,
+		    int step, void *dst);
+
+// Reduce each step x step block to its maximum, so that isolated hot
+// pixels stay visible. NaN/Inf pixels are ignored (a block without
+// finite pixel gives -Inf). The last row and column of blocks can be
+// partial, so dst is ((width + step - 1) / step) x ((height + step - 1)
+// / step). Large frames are split in bands processed in parallel
+void imageDecimateMax(const unsigned char *src, int width, int height,
+		      int step, unsigned char *dst);
+void imageDecimateMax(const unsigned short *src, int width, int height,
+		      int step, unsigned short *dst);
+void imageDecimateMax(const unsigned int *src, int width, int height,
+		      int step, unsigned int *dst);
+void imageDecimateMax(const signed char *src, int width, int height,
+		      int step, signed char *dst);
+void imageDecimateMax(const short *src, int width, int height,
+		      int step, short *dst);
+void imageDecimateMax(const int *src, int width, int height,
+		      int step, int *dst);
+void imageDecimateMax(const float *src, int width, int height,
+		      int step, float *dst);
+void imageDecimateMax(const double *src, int width, int height,
+		      int step, double *dst);
+
+// Halve the image for the display pyramid: each 2x2 block gives its
+// maximum (use_max) or the mean of its finite pixels. Odd edges give
+// 1-pixel wide blocks, so dst is ((width + 1) / 2) x ((height + 1) / 2).
+// Rows are src_stride and dst_stride pixels apart
+void imageReduce(const unsigned char *src, int width, int height,
+		 int src_stride, bool use_max, unsigned char *dst,
+		 int dst_stride);
+void imageReduce(const unsigned short *src, int width, int height,
+		 int src_stride, bool use_max, unsigned short *dst,
+		 int dst_stride);
+void imageReduce(const unsigned int *src, int width, int height,
+		 int src_stride, bool use_max, unsigned int *dst,
+		 int dst_stride);
+void imageReduce(const signed char *src, int width, int height,
+		 int src_stride, bool use_max, signed char *dst,
+		 int dst_stride);
+void imageReduce(const short *src, int width, int height,
+		 int src_stride, bool use_max, short *dst,
+		 int dst_stride);
+void imageReduce(const int *src, int width, int height,
+		 int src_stride, bool use_max, int *dst,
+		 int dst_stride);
+void imageReduce(const float *src, int width, int height,
+		 int src_stride, bool use_max, float *dst,
+		 int dst_stride);
+void imageReduce(const double *src, int width, int height,
+		 int src_stride, bool use_max, double *dst,
+		 int dst_stride);
+
+// Scale the image to dst_width x dst_height (nearest pixel) and map
+// [min_val, max_val] to the ImageLutSize entries of lut. NaN/Inf pixels
+// get lut[0]. dst rows are dst_stride pixels apart
+enum { ImageLutSize = 256 };
+
+void imageColormap(const unsigned char *src, int width, int height,
+		   double min_val, double max_val, const unsigned int *lut,
+		   unsigned int *dst, int dst_width, int dst_height,
+		   int dst_stride);
+void imageColormap(const unsigned short *src, int width, int height,
+		   double min_val, double max_val, const unsigned int *lut,
+		   unsigned int *dst, int dst_width, int dst_height,
+		   int dst_stride);
+void imageColormap(const unsigned int *src, int width, int height,
+		   double min_val, double max_val, const unsigned int *lut,
+		   unsigned int *dst, int dst_width, int dst_height,
+		   int dst_stride);
+void imageColormap(const signed char *src, int width, int height,
+		   double min_val, double max_val, const unsigned int *lut,
+		   unsigned int *dst, int dst_width, int dst_height,
+		   int dst_stride);
+void imageColormap(const short *src, int width, int height,
+		   double min_val, double max_val, const unsigned int *lut,
+		   unsigned int *dst, int dst_width, int dst_height,
+		   int dst_stride);
+void imageColormap(const int *src, int width, int height,
+		   double min_val, double max_val, const unsigned int *lut,
+		   unsigned int *dst, int dst_width, int dst_height,
+		   int dst_stride);
+void imageColormap(const float *src, int width, int height,
+		   double min_val, double max_val, const unsigned int *lut,
+		   unsigned int *dst, int dst_width, int dst_height,
+		   int dst_stride);
+void imageColormap(const double *src, int width, int height,
+		   double min_val, double max_val, const unsigned int *lut,
+		   unsigned int *dst, int dst_width, int dst_height,
+		   int dst_stride);
+
+// Hash of nr_rows rows of row_bytes, stride bytes apart, to detect
+// the changed parts of a frame: changing a single 64-bit word always
+// changes the result
+unsigned long long imageHash(const void *data, int row_bytes, int nr_rows,
+			     long stride);
+
+
+#endif /* __IMAGEPROC_H */
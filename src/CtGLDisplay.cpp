@@ -24,6 +24,10 @@
 #include "CtGLDisplay.h"
 #include "lima/CtSpsImage.h"
 
+#include <iostream>
+#include <unistd.h>
+#include <fcntl.h>
+
 using namespace lima;
 using namespace std;
 
@@ -33,12 +37,46 @@ using namespace std;
 // CtGLDisplay
 //-------------------------------------------------------------
 
+CtGLDisplay::ImageStatusCallback::ImageStatusCallback(CtGLDisplay&
+							ct_gl_display)
+	: m_ct_gl_display(ct_gl_display)
+{
+}
+
+void CtGLDisplay::ImageStatusCallback::imageStatusChanged(
+					const CtControl::ImageStatus& status)
+{
+	m_ct_gl_display.imageStatusChanged(status);
+}
+
 CtGLDisplay::CtGLDisplay(CtControl *ct_control)
-	: m_ct_control(ct_control)
+	: m_ct_control(ct_control), m_img_status_cb(NULL)
 {
 }
 
 CtGLDisplay::~CtGLDisplay()
+{
+	unregisterImageStatusCallback();
+}
+
+void CtGLDisplay::registerImageStatusCallback()
+{
+	if (m_img_status_cb)
+		return;
+	m_img_status_cb = new ImageStatusCallback(*this);
+	m_ct_control->registerImageStatusCallback(*m_img_status_cb);
+}
+
+void CtGLDisplay::unregisterImageStatusCallback()
+{
+	if (!m_img_status_cb)
+		return;
+	m_ct_control->unregisterImageStatusCallback(*m_img_status_cb);
+	delete m_img_status_cb;
+	m_img_status_cb = NULL;
+}
+
+void CtGLDisplay::imageStatusChanged(const CtControl::ImageStatus& /*status*/)
 {
 }
 
@@ -55,6 +93,10 @@ CtSPSGLDisplay::CtSPSGLDisplay(CtControl *ct_control, int argc, char **argv)
 		gl_display = new ForkedSPSGLDisplay(argc, argv);
 		m_sps_gl_display = gl_display;
 	}
+
+	// the array is polled unless setUpdateNotify asks to wake the
+	// display on each new image
+	registerImageStatusCallback();
 }
 
 CtSPSGLDisplay::~CtSPSGLDisplay()
@@ -64,6 +106,7 @@ CtSPSGLDisplay::~CtSPSGLDisplay()
 
 void CtSPSGLDisplay::closeWindow()
 {
+	unregisterImageStatusCallback();
 	if (m_sps_gl_display)
 		delete m_sps_gl_display;
 	m_sps_gl_display = NULL;
@@ -102,6 +145,16 @@ void CtSPSGLDisplay::getSpecArray(string& spec_name, string& array_name)
 	m_sps_gl_display->getSpecArray(spec_name, array_name);
 }
 
+void CtSPSGLDisplay::addSpecArray(string spec_name, string array_name)
+{
+	typedef ForkedSPSGLDisplay ForkedKlass;
+	ForkedKlass *gl_display;
+	if (m_use_forked) {
+		gl_display = reinterpret_cast<ForkedKlass *>(m_sps_gl_display);
+		gl_display->addSpecArray(spec_name, array_name);
+	}
+}
+
 void CtSPSGLDisplay::setRefreshTime(float refresh_time)
 {
 	typedef ForkedSPSGLDisplay ForkedKlass;
@@ -112,19 +165,336 @@ void CtSPSGLDisplay::setRefreshTime(float refresh_time)
 	}
 }
 
+void CtSPSGLDisplay::setZeroCopy(bool active)
+{
+	m_sps_gl_display->setZeroCopy(active);
+}
+
+bool CtSPSGLDisplay::getZeroCopy()
+{
+	return m_sps_gl_display->getZeroCopy();
+}
+
+void CtSPSGLDisplay::setDecimateMax(bool active)
+{
+	m_sps_gl_display->setDecimateMax(active);
+}
+
+bool CtSPSGLDisplay::getDecimateMax()
+{
+	return m_sps_gl_display->getDecimateMax();
+}
+
+void CtSPSGLDisplay::setUpdateNotify(bool active)
+{
+	m_sps_gl_display->setUpdateNotify(active);
+}
+
+bool CtSPSGLDisplay::getUpdateNotify()
+{
+	return m_sps_gl_display->getUpdateNotify();
+}
+
+void CtSPSGLDisplay::imageStatusChanged(const CtControl::ImageStatus&
+								/*status*/)
+{
+	if (m_sps_gl_display && m_sps_gl_display->getUpdateNotify())
+		m_sps_gl_display->notifyUpdate();
+}
+
 void CtSPSGLDisplay::getRates(float *update, float *refresh)
 {
 	m_sps_gl_display->getRates(update, refresh);
 }
 
-void CtSPSGLDisplay::getNorm(unsigned long *minval, unsigned long *maxval,
+void CtSPSGLDisplay::getNorm(double *minval, double *maxval,
 			     int *autorange)
 {
 	m_sps_gl_display->getNorm(minval, maxval, autorange);
 }
 
-void CtSPSGLDisplay::setNorm(unsigned long minval, unsigned long maxval,
+void CtSPSGLDisplay::setNorm(double minval, double maxval,
 			     int autorange)
 {
 	m_sps_gl_display->setNorm(minval, maxval, autorange);
 }
+
+void CtSPSGLDisplay::getFrameStats(unsigned long *displayed,
+				   unsigned long *skipped,
+				   unsigned long *acquired)
+{
+	m_sps_gl_display->getFrameStats(displayed, skipped, acquired);
+}
+
+void CtSPSGLDisplay::getUploadStats(unsigned long long *uploaded,
+				    unsigned long long *saved)
+{
+	m_sps_gl_display->getUploadStats(uploaded, saved);
+}
+
+void CtSPSGLDisplay::getPacingStats(unsigned long *wakeups, float *interval,
+				    float *jitter)
+{
+	m_sps_gl_display->getPacingStats(wakeups, interval, jitter);
+}
+
+
+//-------------------------------------------------------------
+// CtDirectGLDisplay
+//-------------------------------------------------------------
+
+CtDirectGLDisplay::CtDirectGLDisplay(CtControl *ct_control,
+				     int argc, char **argv)
+	: CtGLDisplay(ct_control), m_caption("LImA"), m_argc(argc),
+	  m_argv(argv)
+{
+	m_gldisplay = new GLDisplay(argc, argv);
+	m_data_ready = false;
+	m_last_frame_nb = -1;
+
+	if (pipe(m_notify_fd) == 0) {
+		for (int i = 0; i < 2; ++i)
+			fcntl(m_notify_fd[i], F_SETFL, O_NONBLOCK);
+	} else {
+		cerr << "Could not create update notify pipe" << endl;
+		m_notify_fd[0] = m_notify_fd[1] = -1;
+	}
+
+	registerImageStatusCallback();
+}
+
+CtDirectGLDisplay::~CtDirectGLDisplay()
+{
+	closeWindow();
+
+	for (int i = 0; i < 2; ++i)
+		if (m_notify_fd[i] >= 0)
+			close(m_notify_fd[i]);
+}
+
+void CtDirectGLDisplay::setCaption(string caption)
+{
+	m_caption = caption;
+}
+
+void CtDirectGLDisplay::closeWindow()
+{
+	unregisterImageStatusCallback();
+	if (m_gldisplay)
+		delete m_gldisplay;
+	m_gldisplay = NULL;
+
+	// give the frames back to LIMA
+	m_published_data.clear();
+	AutoMutex lock(m_mutex);
+	m_ready_data = Data();
+	m_data_ready = false;
+}
+
+// a closed display is created again, and fed again with the frames
+void CtDirectGLDisplay::createWindow()
+{
+	if (!m_gldisplay) {
+		m_gldisplay = new GLDisplay(m_argc, m_argv);
+		registerImageStatusCallback();
+	} else if (m_gldisplay->isClosed()) {
+		// the frames of the closed window are no longer used
+		m_published_data.clear();
+	}
+	m_gldisplay->createWindow(m_caption);
+}
+
+GLDisplay *CtDirectGLDisplay::getGLDisplay()
+{
+	if (!m_gldisplay) {
+		cerr << "CtDirectGLDisplay window closed" << endl;
+		throw exception();
+	}
+	return m_gldisplay;
+}
+
+bool CtDirectGLDisplay::isClosed()
+{
+	return !m_gldisplay || m_gldisplay->isClosed();
+}
+
+void CtDirectGLDisplay::refresh()
+{
+	if (isClosed())
+		return;
+	checkUpdate();
+	m_gldisplay->refresh();
+}
+
+void CtDirectGLDisplay::setTestImage(bool active)
+{
+	getGLDisplay()->setTestImage(active);
+}
+
+bool CtDirectGLDisplay::waitUpdate(float timeout)
+{
+	if (isClosed())
+		return false;
+
+	bool notified = m_gldisplay->waitEvents(m_notify_fd[0], timeout);
+	if (notified) {
+		char buffer[64];
+		while (read(m_notify_fd[0], buffer, sizeof(buffer)) > 0)
+			;
+	}
+	return notified;
+}
+
+void CtDirectGLDisplay::notifyUpdate()
+{
+	if (m_notify_fd[1] < 0)
+		return;
+
+	// if the pipe is full the display is going to wake up anyway
+	char c = 0;
+	ssize_t ret = write(m_notify_fd[1], &c, 1);
+	(void) ret;
+}
+
+bool CtDirectGLDisplay::getPixelType(const Data& data, int& depth,
+				     GLDisplay::PixelType& type)
+{
+	switch (data.type) {
+	case Data::UINT8:  depth = 1; type = GLDisplay::Unsigned; break;
+	case Data::INT8:   depth = 1; type = GLDisplay::Signed;   break;
+	case Data::UINT16: depth = 2; type = GLDisplay::Unsigned; break;
+	case Data::INT16:  depth = 2; type = GLDisplay::Signed;   break;
+	case Data::UINT32: depth = 4; type = GLDisplay::Unsigned; break;
+	case Data::INT32:  depth = 4; type = GLDisplay::Signed;   break;
+	case Data::FLOAT:  depth = 4; type = GLDisplay::Float;    break;
+	case Data::DOUBLE: depth = 8; type = GLDisplay::Float;    break;
+	default:
+		return false;
+	}
+	return (data.dimensions.size() == 2);
+}
+
+// called in the LIMA image status thread: the frame is referenced,
+// not copied, and replaces the previous one if not published yet
+void CtDirectGLDisplay::imageStatusChanged(const CtControl::ImageStatus&
+								status)
+{
+	long frame_nb = status.LastImageReady;
+	if (frame_nb < 0) {
+		m_last_frame_nb = -1;
+		return;
+	} else if (frame_nb == m_last_frame_nb) {
+		return;
+	}
+	m_last_frame_nb = frame_nb;
+
+	Data data;
+	try {
+		m_ct_control->ReadImage(data, frame_nb);
+	} catch (Exception&) {
+		// already overwritten in the buffer, a newer one will come
+		return;
+	}
+
+	{
+		AutoMutex lock(m_mutex);
+		m_ready_data = data;
+		m_data_ready = true;
+	}
+
+	notifyUpdate();
+}
+
+// called in the display thread. The published frames stay referenced
+// until the window hands them back
+bool CtDirectGLDisplay::checkUpdate()
+{
+	releasePublished();
+
+	Data data;
+	{
+		AutoMutex lock(m_mutex);
+		if (!m_data_ready)
+			return false;
+		data = m_ready_data;
+		m_ready_data = Data();
+		m_data_ready = false;
+	}
+
+	int depth;
+	GLDisplay::PixelType type;
+	if (!getPixelType(data, depth, type)) {
+		cerr << "Unsupported LIMA image type: " << data.type << endl;
+		return false;
+	}
+
+	// replaces the frame not shown yet, if the window is late
+	m_gldisplay->publishBuffer(data.data(), data.dimensions[0],
+				   data.dimensions[1], depth, type);
+	m_published_data.push_back(data);
+	releasePublished();
+
+	m_gldisplay->updateBuffer(data.frameNumber);
+	return true;
+}
+
+// not in publication order
+void CtDirectGLDisplay::releasePublished()
+{
+	void *buffer_ptr;
+	while (m_gldisplay->reclaimBuffer(buffer_ptr)) {
+		DataList::iterator it, end = m_published_data.end();
+		for (it = m_published_data.begin(); it != end; ++it) {
+			if (it->data() == buffer_ptr) {
+				m_published_data.erase(it);
+				break;
+			}
+		}
+	}
+}
+
+void CtDirectGLDisplay::getRates(float *update, float *refresh)
+{
+	getGLDisplay()->getRates(update, refresh);
+}
+
+void CtDirectGLDisplay::getNorm(double *minval, double *maxval,
+				int *autorange)
+{
+	getGLDisplay()->getNorm(minval, maxval, autorange);
+}
+
+void CtDirectGLDisplay::setNorm(double minval, double maxval,
+				int autorange)
+{
+	getGLDisplay()->setNorm(minval, maxval, autorange);
+}
+
+void CtDirectGLDisplay::getFrameStats(unsigned long *displayed,
+				      unsigned long *skipped,
+				      unsigned long *acquired)
+{
+	getGLDisplay()->getFrameStats(displayed, skipped, acquired);
+}
+
+void CtDirectGLDisplay::getUploadStats(unsigned long long *uploaded,
+				       unsigned long long *saved)
+{
+	getGLDisplay()->getUploadStats(uploaded, saved);
+}
+
+void CtDirectGLDisplay::getPacingStats(unsigned long *wakeups, 
+				       float *interval, float *jitter)
+{
+	getGLDisplay()->getPacingStats(wakeups, interval, jitter);
+}
+
+void CtDirectGLDisplay::getViewSize(int *width, int *height)
+{
+	getGLDisplay()->getViewSize(width, height);
+}
+
+bool CtDirectGLDisplay::getRenderedFrame(void *rgba, int width, int height)
+{
+	return getGLDisplay()->getRenderedFrame(rgba, width, height);
+}
@@ -23,14 +23,18 @@
 #include "GLDisplay.h"
 
 #include "image.h"
+#include "imageproc.h"
 #include "sps.h"
 
 #include <iostream>
 #include <sstream>
 #include <signal.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <algorithm>
 
 using namespace std;
@@ -126,13 +130,35 @@ void GLDisplay::setTestImage(bool active)
 	m_image_lib->setTestImage(getImageWindow(), active);
 }
 
-void GLDisplay::setBuffer(void *buffer_ptr, int width, int height, int depth)
+// the buffer must stay valid until the next one has been displayed
+void GLDisplay::setBuffer(void *buffer_ptr, int width, int height, int depth,
+			  PixelType type)
 {
-	getImageWindow()->setBuffer(buffer_ptr, width, height, depth);
+	// PixelType values follow ImagePixelPtr::Type
+	ImagePixelPtr::Type pixel_type = ImagePixelPtr::Type(type);
+	getImageWindow()->setBuffer(buffer_ptr, width, height, depth,
+				    pixel_type);
 }
 
-void GLDisplay::updateBuffer()
+// the buffer replaces the one not shown yet, belongs to the window
+// until given back by reclaimBuffer and is shown by the next updateBuffer
+void GLDisplay::publishBuffer(void *buffer_ptr, int width, int height,
+			      int depth, PixelType type)
 {
+	ImagePixelPtr::Type pixel_type = ImagePixelPtr::Type(type);
+	getImageWindow()->publishBuffer(buffer_ptr, width, height, depth,
+					pixel_type);
+}
+
+bool GLDisplay::reclaimBuffer(void *& buffer_ptr)
+{
+	return getImageWindow()->reclaimBuffer(buffer_ptr);
+}
+
+void GLDisplay::updateBuffer(long frame_nb)
+{
+	if (frame_nb >= 0)
+		getImageWindow()->setFrameNb(frame_nb);
 	getImageWindow()->update(false);
 }
 
@@ -141,52 +167,116 @@ void GLDisplay::refresh()
 	m_image_lib->poll();
 }
 
+bool GLDisplay::waitEvents(int fd, float timeout)
+{
+	return (m_image_lib->waitEvents(fd, timeout) > 0);
+}
+
 void GLDisplay::getRates(float *update, float *refresh)
 {
 	getImageWindow()->getRates(update, refresh);
 }
 
-void GLDisplay::getNorm(unsigned long *minval, unsigned long *maxval,
+void GLDisplay::getFrameStats(unsigned long *displayed,
+			      unsigned long *skipped, unsigned long *acquired)
+{
+	getImageWindow()->getFrameStats(displayed, skipped, acquired);
+}
+
+void GLDisplay::getUploadStats(unsigned long long *uploaded,
+			       unsigned long long *saved)
+{
+	getImageWindow()->getUploadStats(uploaded, saved);
+}
+
+void GLDisplay::getPacingStats(unsigned long *wakeups, float *interval,
+			       float *jitter)
+{
+	getImageWindow()->getPacingStats(wakeups, interval, jitter);
+}
+
+void GLDisplay::getNorm(double *minval, double *maxval,
 			int *autorange)
 {
 	getImageWindow()->getNorm(minval, maxval, autorange);
 }
 
-void GLDisplay::setNorm(unsigned long minval, unsigned long maxval,
+void GLDisplay::setNorm(double minval, double maxval,
 			int autorange)
 {
 	getImageWindow()->setNorm(minval, maxval, autorange);
 }
 
+void GLDisplay::getViewSize(int *width, int *height)
+{
+	getImageWindow()->getViewSize(width, height);
+}
+
+// with IMAGE_OFFSCREEN set: RGBA copy of the last frame drawn, 
+// width x height as given by getViewSize
+bool GLDisplay::getRenderedFrame(void *rgba, int width, int height)
+{
+	return getImageWindow()->getRenderedFrame(rgba, width, height);
+}
+
 
 //-------------------------------------------------------------
 // SPSGLDisplayBase
 //-------------------------------------------------------------
 
-const int SPSGLDisplayBase::SPS_TypeDepth[SPS_NrTypes] = {
-	0,	// SPS_DOUBLE
-	0,	// SPS_FLOAT
-	4,	// SPS_INT
-	4,	// SPS_UINT
-	2,	// SPS_SHORT
-	2,	// SPS_USHORT
-	1,	// SPS_CHAR
-	1,	// SPS_UCHAR
-	0,	// SPS_STRING
-	4,	// SPS_LONG
-	4,	// SPS_ULONG
+const SPSGLDisplayBase::SPSTypeInfo
+SPSGLDisplayBase::SPS_TypeInfo[SPS_NrTypes] = {
+	{8, GLDisplay::Float},		// SPS_DOUBLE
+	{4, GLDisplay::Float},		// SPS_FLOAT
+	{4, GLDisplay::Signed},		// SPS_INT
+	{4, GLDisplay::Unsigned},	// SPS_UINT
+	{2, GLDisplay::Signed},		// SPS_SHORT
+	{2, GLDisplay::Unsigned},	// SPS_USHORT
+	{1, GLDisplay::Signed},		// SPS_CHAR
+	{1, GLDisplay::Unsigned},	// SPS_UCHAR
+	{0, GLDisplay::Unsigned},	// SPS_STRING
+	{4, GLDisplay::Signed},		// SPS_LONG
+	{4, GLDisplay::Unsigned},	// SPS_ULONG
 };
 
-SPSGLDisplayBase::SPSGLDisplayBase(int argc, char **argv)
+SPSGLDisplayBase::SPSGLDisplayBase(int argc, char **argv, bool notify_pipe)
 {
 	m_gldisplay = new GLDisplay(argc, argv);
 	m_buffer_ptr = NULL;
+	m_zero_copy = false;
+	m_decimate_max = false;
+	m_update_counter = -1;
+	m_torn_frames = 0;
+	m_width = m_height = m_depth = 0;
+	m_type = GLDisplay::Unsigned;
+	m_step = 1;
+	m_src_ptr = NULL;
+
+	// created before forking, so shared with the display child. Not
+	// needed by the extra arrays of a forked display, never notified
+	m_update_notify = false;
+	m_notify_fd[0] = m_notify_fd[1] = -1;
+	if (!notify_pipe)
+		return;
+	if (pipe(m_notify_fd) == 0) {
+		for (int i = 0; i < 2; ++i)
+			fcntl(m_notify_fd[i], F_SETFL, O_NONBLOCK);
+	} else {
+		cerr << "Could not create update notify pipe" << endl;
+		m_notify_fd[0] = m_notify_fd[1] = -1;
+	}
 }
 
 SPSGLDisplayBase::~SPSGLDisplayBase()
 {
+	// the window is gone: all the published buffers are free
 	delete m_gldisplay;
+	m_gldisplay = NULL;
 	releaseBuffer();
+
+	for (int i = 0; i < 2; ++i)
+		if (m_notify_fd[i] >= 0)
+			close(m_notify_fd[i]);
 }
 
 void SPSGLDisplayBase::setSpecArray(string spec_name, string array_name)
@@ -209,16 +299,238 @@ void SPSGLDisplayBase::setCaption(string caption)
 	m_caption = caption;
 }
 
-void SPSGLDisplayBase::releaseBuffer()
+void SPSGLDisplayBase::setZeroCopy(bool active)
+{
+	if (active == m_zero_copy)
+		return;
+
+	// the current buffer belongs to the previous mode
+	releaseBuffer();
+	m_zero_copy = active;
+}
+
+bool SPSGLDisplayBase::getZeroCopy()
+{
+	return m_zero_copy;
+}
+
+// reduce the large arrays to the max of each block instead of one
+// pixel out of step: the hot pixels stay visible, at a higher cost
+void SPSGLDisplayBase::setDecimateMax(bool active)
+{
+	m_decimate_max = active;
+}
+
+bool SPSGLDisplayBase::getDecimateMax()
+{
+	return m_decimate_max;
+}
+
+void SPSGLDisplayBase::setUpdateNotify(bool active)
+{
+	m_update_notify = active;
+}
+
+bool SPSGLDisplayBase::getUpdateNotify()
+{
+	return m_update_notify;
+}
+
+void SPSGLDisplayBase::notifyUpdate()
+{
+	if (m_notify_fd[1] < 0)
+		return;
+
+	// if the pipe is full the display is going to wake up anyway
+	char c = 0;
+	if (write(m_notify_fd[1], &c, 1) < 0)
+		debug << "Update notify pipe full" << endl;
+}
+
+bool SPSGLDisplayBase::waitUpdate(float timeout)
 {
-	if (m_buffer_ptr) {
-		char *spec_name = const_cast<char *>(m_spec_name.c_str());
-		char *array_name = const_cast<char *>(m_array_name.c_str());
-		SPS_FreeDataCopy(spec_name, array_name);
+	bool notified = m_gldisplay->waitEvents(m_notify_fd[0], timeout);
+	if (notified) {
+		char buffer[64];
+		while (read(m_notify_fd[0], buffer, sizeof(buffer)) > 0)
+			;
 	}
+	return notified;
+}
+
+// the published buffers are freed once handed back by the window
+void SPSGLDisplayBase::releaseBuffer()
+{
+	reclaimBuffers();
+	freeSpareBuffers();
+	if (m_src_ptr)
+		SPS_ReturnDataPointer(m_src_ptr);
 
+	m_src_ptr = NULL;
 	m_buffer_ptr = NULL;
 	m_width = m_height = m_depth = 0;
+	m_update_counter = -1;
+}
+
+// the window shows the buffer until it takes a newer one
+void SPSGLDisplayBase::publishBuffer(const Buffer& buffer)
+{
+	int width, height;
+	getBufferDim(width, height);
+	m_gldisplay->publishBuffer(buffer.ptr, width, height, m_depth,
+				   m_type);
+	m_published.push_back(buffer);
+	m_buffer_ptr = buffer.ptr;
+	reclaimBuffers();
+}
+
+// free the buffers handed back by the window, all of them if it is gone
+void SPSGLDisplayBase::reclaimBuffers()
+{
+	if (!m_gldisplay || m_gldisplay->isClosed()) {
+		while (!m_published.empty()) {
+			freeBuffer(m_published.front());
+			m_published.pop_front();
+		}
+		m_buffer_ptr = NULL;
+		return;
+	}
+
+	// not in publication order: the same attached pointer or NULL can
+	// be published twice, any of them can be released
+	void *ptr;
+	while (m_gldisplay->reclaimBuffer(ptr)) {
+		BufferList::iterator it, end = m_published.end();
+		for (it = m_published.begin(); it != end; ++it)
+			if (it->ptr == ptr)
+				break;
+		if (it == end) {
+			cerr << "SPSGLDisplay: unknown buffer " << ptr << endl;
+			continue;
+		}
+		freeBuffer(*it);
+		m_published.erase(it);
+	}
+}
+
+// the copies of the current size are kept for the next frames
+void SPSGLDisplayBase::freeBuffer(const Buffer& buffer)
+{
+	if (buffer.attached)
+		SPS_ReturnDataPointer(buffer.ptr);
+	else if (buffer.ptr && !m_zero_copy && (buffer.size == getCopySize()))
+		m_spare_buffers.push_back(buffer.ptr);
+	else
+		free(buffer.ptr);
+}
+
+void SPSGLDisplayBase::freeSpareBuffers()
+{
+	while (!m_spare_buffers.empty()) {
+		free(m_spare_buffers.back());
+		m_spare_buffers.pop_back();
+	}
+}
+
+// the window shows the whole frame: the copy is reduced by the integer
+// part of its reduction factor
+int SPSGLDisplayBase::getViewStep(int cols, int rows)
+{
+	if (m_zero_copy)
+		return 1;
+
+	int view_width, view_height;
+	m_gldisplay->getViewSize(&view_width, &view_height);
+	if ((view_width <= 0) || (view_height <= 0))
+		return 1;
+	return max(1, max(cols / view_width, rows / view_height));
+}
+
+// copy the attached array, reduced by m_step, into a buffer of our own:
+// the window keeps it while the array is written
+void SPSGLDisplayBase::copyData()
+{
+	char *spec_name = const_cast<char *>(m_spec_name.c_str());
+	char *array_name = const_cast<char *>(m_array_name.c_str());
+
+	if (!m_src_ptr)
+		m_src_ptr = SPS_GetDataPointer(spec_name, array_name, 0);
+	if (!m_src_ptr)
+		return;
+
+	int size = getCopySize();
+	void *ptr;
+	if (!m_spare_buffers.empty()) {
+		ptr = m_spare_buffers.back();
+		m_spare_buffers.pop_back();
+	} else {
+		ptr = malloc(size);
+	}
+	if (!ptr)
+		throw exception();
+
+	if (m_step > 1)
+		decimateData(ptr);
+	else
+		memcpy(ptr, m_src_ptr, size);
+
+	publishBuffer(Buffer(ptr, false, size));
+}
+
+// the edge blocks of the decimated copy can be partial
+void SPSGLDisplayBase::getBufferDim(int& width, int& height)
+{
+	width = (m_width + m_step - 1) / m_step;
+	height = (m_height + m_step - 1) / m_step;
+}
+
+int SPSGLDisplayBase::getCopySize()
+{
+	int width, height;
+	getBufferDim(width, height);
+	return width * height * m_depth;
+}
+
+// copy one pixel, or the max, of each step x step block of the 
+// attached array
+void SPSGLDisplayBase::decimateData(void *dst_ptr)
+{
+	void *s = m_src_ptr, *d = dst_ptr;
+	int w = m_width, h = m_height, step = m_step;
+	if (!m_decimate_max) {
+		imageSubsample(s, w, h, m_depth, step, d);
+		return;
+	}
+
+	switch (m_type) {
+	case GLDisplay::Float:
+		if (m_depth == 4)
+			imageDecimateMax((float *) s, w, h, step, (float *) d);
+		else
+			imageDecimateMax((double *) s, w, h, step, 
+					 (double *) d);
+		break;
+	case GLDisplay::Signed:
+		switch (m_depth) {
+		case 1: imageDecimateMax((signed char *) s, w, h, step, 
+					 (signed char *) d); break;
+		case 2: imageDecimateMax((short *) s, w, h, step, 
+					 (short *) d); break;
+		case 4: imageDecimateMax((int *) s, w, h, step, 
+					 (int *) d); break;
+		}
+		break;
+	default:
+		switch (m_depth) {
+		case 1: imageDecimateMax((unsigned char *) s, w, h, step, 
+					 (unsigned char *) d); break;
+		case 2: imageDecimateMax((unsigned short *) s, w, h, step, 
+					 (unsigned short *) d); break;
+		case 4: imageDecimateMax((unsigned int *) s, w, h, step, 
+					 (unsigned int *) d); break;
+		}
+		break;
+	}
 }
 
 bool SPSGLDisplayBase::checkSpecArray()
@@ -229,41 +541,88 @@ bool SPSGLDisplayBase::checkSpecArray()
 	int rows, cols, type;
 	if (SPS_GetArrayInfo(spec_name, array_name, &rows, &cols, &type,
 			     NULL)) {
+		// the array is gone: the window must hand back its frame
+		bool shown = (!m_published.empty() && m_published.back().ptr);
 		releaseBuffer();
-		return false;
+		if (shown)
+			publishBuffer(Buffer());
+		return shown;
 	}
 
-	void *prev_buffer_ptr = m_buffer_ptr;
+	// the buffer belongs to the previous step
+	int step = getViewStep(cols, rows);
+	if (step != m_step) {
+		releaseBuffer();
+		m_step = step;
+	}
 
-	int depth = SPS_TypeDepth[type];
+	int depth = SPS_TypeInfo[type].depth;
+	GLDisplay::PixelType pixel_type = SPS_TypeInfo[type].type;
 	bool size_changed = ((cols != m_width) || (rows != m_height) ||
-			     (depth != m_depth));
-	bool need_update = size_changed || SPS_IsUpdated(spec_name,
-							 array_name);
-	if (need_update)
-		m_buffer_ptr = SPS_GetDataCopy(spec_name, array_name, type,
-					       &rows, &cols);
+			     (depth != m_depth) || (pixel_type != m_type));
 	if (size_changed) {
-		SPS_IsUpdated(spec_name, array_name); 	// force update sync
+		// the array could be re-created: attach it again
+		releaseBuffer();
 		m_width = cols;
 		m_height = rows;
 		m_depth = depth;
+		m_type = pixel_type;
 	}
 
-	if (size_changed || (m_buffer_ptr != prev_buffer_ptr))
-		m_gldisplay->setBuffer(m_buffer_ptr, m_width, m_height,
-				       m_depth);
+	bool need_update;
+	if (m_zero_copy) {
+		// optimistic: counter is read before the frame is used,
+		// and checked again by checkFrameTorn after the refresh
+		int counter = SPS_UpdateCounter(spec_name, array_name);
+		need_update = size_changed || (counter != m_update_counter);
+		m_update_counter = counter;
+		void *ptr = NULL;
+		if (!m_buffer_ptr)
+			ptr = SPS_GetDataPointer(spec_name, array_name, 0);
+		if (ptr)
+			publishBuffer(Buffer(ptr, true));
+	} else {
+		need_update = size_changed || SPS_IsUpdated(spec_name,
+							    array_name);
+		if (need_update) {
+			// frame sequence number for the display statistics
+			m_update_counter = SPS_UpdateCounter(spec_name,
+							     array_name);
+			copyData();
+		}
+	}
+	if (size_changed)
+		SPS_IsUpdated(spec_name, array_name); 	// force update sync
 
 	return need_update;
 }
 
+bool SPSGLDisplayBase::checkFrameTorn()
+{
+	if (!m_zero_copy || !m_buffer_ptr)
+		return false;
+
+	char *spec_name = const_cast<char *>(m_spec_name.c_str());
+	char *array_name = const_cast<char *>(m_array_name.c_str());
+
+	// the array was written while being displayed: the next 
+	// checkSpecArray will see a new counter and redraw the frame
+	bool torn = (SPS_UpdateCounter(spec_name, array_name) !=
+		     m_update_counter);
+	if (torn) {
+		++m_torn_frames;
+		debug << "Possibly torn frame #" << m_torn_frames << endl;
+	}
+	return torn;
+}
+
 
 //-------------------------------------------------------------
 // LocalSPSGLDisplay
 //-------------------------------------------------------------
 
-LocalSPSGLDisplay::LocalSPSGLDisplay(int argc, char **argv)
-	: SPSGLDisplayBase(argc, argv)
+LocalSPSGLDisplay::LocalSPSGLDisplay(int argc, char **argv, bool notify_pipe)
+	: SPSGLDisplayBase(argc, argv, notify_pipe)
 {
 }
 
@@ -288,9 +647,22 @@ bool LocalSPSGLDisplay::isClosed()
 
 void LocalSPSGLDisplay::refresh()
 {
-	if (checkSpecArray())
-		m_gldisplay->updateBuffer();
+	checkUpdate();
 	m_gldisplay->refresh();
+	checkTorn();
+}
+
+bool LocalSPSGLDisplay::checkUpdate()
+{
+	bool updated = checkSpecArray();
+	if (updated)
+		m_gldisplay->updateBuffer(m_update_counter);
+	return updated;
+}
+
+bool LocalSPSGLDisplay::checkTorn()
+{
+	return checkFrameTorn();
 }
 
 void LocalSPSGLDisplay::getRates(float *update, float *refresh)
@@ -298,13 +670,32 @@ void LocalSPSGLDisplay::getRates(float *update, float *refresh)
 	m_gldisplay->getRates(update, refresh);
 }
 
-void LocalSPSGLDisplay::getNorm(unsigned long *minval, unsigned long *maxval,
+void LocalSPSGLDisplay::getFrameStats(unsigned long *displayed,
+				      unsigned long *skipped,
+				      unsigned long *acquired)
+{
+	m_gldisplay->getFrameStats(displayed, skipped, acquired);
+}
+
+void LocalSPSGLDisplay::getUploadStats(unsigned long long *uploaded,
+				       unsigned long long *saved)
+{
+	m_gldisplay->getUploadStats(uploaded, saved);
+}
+
+void LocalSPSGLDisplay::getPacingStats(unsigned long *wakeups, 
+				       float *interval, float *jitter)
+{
+	m_gldisplay->getPacingStats(wakeups, interval, jitter);
+}
+
+void LocalSPSGLDisplay::getNorm(double *minval, double *maxval,
 				int *autorange)
 {
 	m_gldisplay->getNorm(minval, maxval, autorange);
 }
 
-void LocalSPSGLDisplay::setNorm(unsigned long minval, unsigned long maxval,
+void LocalSPSGLDisplay::setNorm(double minval, double maxval,
 				int autorange)
 {
 	m_gldisplay->setNorm(minval, maxval, autorange);
@@ -317,6 +708,7 @@ void LocalSPSGLDisplay::setNorm(unsigned long minval, unsigned long maxval,
 
 const float ForkedSPSGLDisplay::ParentCheckTime = 0.5;
 const float ForkedSPSGLDisplay::DefaultRefreshTime = 10e-3;
+const int ForkedSPSGLDisplay::DoublePrecision = 17;
 
 const string ForkedSPSGLDisplay::CmdList[NrCmd] = {
 	"quit",
@@ -325,10 +717,16 @@ const string ForkedSPSGLDisplay::CmdList[NrCmd] = {
 	"getnorm",
 	"setnorm",
 	"setrefreshtime",
+	"setzerocopy",
+	"setupdatenotify",
+	"setdecimatemax",
+	"getframestats",
+	"getuploadstats",
+	"getpacingstats",
 };
 
 ForkedSPSGLDisplay::ForkedSPSGLDisplay(int argc, char **argv)
-	: SPSGLDisplayBase(argc, argv)
+	: SPSGLDisplayBase(argc, argv), m_argc(argc), m_argv(argv)
 {
 	m_parent_pid = m_child_pid = 0;
 	m_child_ended = false;
@@ -366,13 +764,71 @@ void ForkedSPSGLDisplay::createWindow()
 	}
 }
 
+void ForkedSPSGLDisplay::addSpecArray(string spec_name, string array_name)
+{
+	if (m_child_pid) {
+		cerr << "Extra arrays must be added before creating the window"
+		     << endl;
+		throw exception();
+	}
+	m_extra_arrays.push_back(SpecArray(spec_name, array_name));
+}
+
+// the extra arrays are never notified: no pipe for them
+void ForkedSPSGLDisplay::createExtraDisplays()
+{
+	SpecArrayList::const_iterator it, end = m_extra_arrays.end();
+	for (it = m_extra_arrays.begin(); it != end; ++it) {
+		LocalSPSGLDisplay *display;
+		display = new LocalSPSGLDisplay(m_argc, m_argv, false);
+		display->setSpecArray(it->first, it->second);
+		display->setZeroCopy(m_zero_copy);
+		display->setDecimateMax(m_decimate_max);
+		display->setUpdateNotify(m_update_notify);
+		display->createWindow();
+		m_extra_displays.push_back(display);
+	}
+}
+
+bool ForkedSPSGLDisplay::checkExtraDisplays()
+{
+	bool updated = false;
+	LocalDisplayList::iterator it, end = m_extra_displays.end();
+	for (it = m_extra_displays.begin(); it != end; ++it)
+		if (!(*it)->isClosed() && (*it)->checkUpdate())
+			updated = true;
+	return updated;
+}
+
+void ForkedSPSGLDisplay::deleteExtraDisplays()
+{
+	while (!m_extra_displays.empty()) {
+		delete m_extra_displays.back();
+		m_extra_displays.pop_back();
+	}
+}
+
 void ForkedSPSGLDisplay::runChild()
 {
+	bool notified = false;
+	bool polling = true;
+
+	// all the windows share the same ImageLib and are served
+	// by this single loop; the child ends with the main window
 	m_gldisplay->createWindow(m_caption);
+	createExtraDisplays();
 	while (!m_gldisplay->isClosed() && checkParentAlive()) {
-		if (checkSpecArray())
-			m_gldisplay->updateBuffer();
+		bool updated = checkSpecArray();
+		if (updated)
+			m_gldisplay->updateBuffer(m_update_counter);
+		if (checkExtraDisplays())
+			updated = true;
 		m_gldisplay->refresh();
+		checkFrameTorn();
+		LocalDisplayList::iterator it, end = m_extra_displays.end();
+		for (it = m_extra_displays.begin(); it != end; ++it)
+			if (!(*it)->isClosed())
+				(*it)->checkTorn();
 
 		string cmd;
 		try {
@@ -385,11 +841,31 @@ void ForkedSPSGLDisplay::runChild()
 			break;
 		}
 
-		Sleep(m_refresh_time);
+		if (!m_update_notify) {
+			Sleep(m_refresh_time);
+			continue;
+		}
+
+		// the notification can arrive before SPS sees the new frame:
+		// check once more after a refresh period before blocking.
+		// Only the main array notifies: the extra ones are polled.
+		// A frame seen without notification means that the writer
+		// does not notify: it is polled until it does
+		if (notified)
+			polling = false;
+		else if (updated)
+			polling = true;
+		float timeout = ParentCheckTime;
+		if ((notified && !updated) || polling || 
+		    !m_extra_displays.empty())
+			timeout = m_refresh_time;
+		notified = waitUpdate(timeout);
 	}
 
-	releaseBuffer();
+	deleteExtraDisplays();
 	delete m_gldisplay;
+	m_gldisplay = NULL;
+	releaseBuffer();
 
 	_exit(0);
 }
@@ -412,6 +888,8 @@ string ForkedSPSGLDisplay::sendChildCmd(string cmd)
 	cmd.append("\n");
 	debug << "Sending: " << cmd;
 	m_cmd_pipe->write(cmd);
+	// wake up the child if waiting for updates
+	notifyUpdate();
 
 	string ans;
 	ans = m_res_pipe->readLine(1024, "\n");
@@ -476,21 +954,64 @@ bool ForkedSPSGLDisplay::processParentCmd(string cmd_str)
 		ostringstream os;
 		os << ans << " " << update << " " << refresh;
 		ans = os.str();
+	} else if (cmd == CmdGetFrameStats) {
+		unsigned long displayed, skipped, acquired;
+		m_gldisplay->getFrameStats(&displayed, &skipped, &acquired);
+		ostringstream os;
+		os << ans << " " << displayed << " " << skipped << " "
+		   << acquired;
+		ans = os.str();
+	} else if (cmd == CmdGetUploadStats) {
+		unsigned long long uploaded, saved;
+		m_gldisplay->getUploadStats(&uploaded, &saved);
+		ostringstream os;
+		os << ans << " " << uploaded << " " << saved;
+		ans = os.str();
+	} else if (cmd == CmdGetPacingStats) {
+		unsigned long wakeups;
+		float interval, jitter;
+		m_gldisplay->getPacingStats(&wakeups, &interval, &jitter);
+		ostringstream os;
+		os << ans << " " << wakeups << " " << interval << " " 
+		   << jitter;
+		ans = os.str();
 	} else if (cmd == CmdGetNorm) {
-		unsigned long minval, maxval;
+		double minval, maxval;
 		int autorange;
 		m_gldisplay->getNorm(&minval, &maxval, &autorange);
 		ostringstream os;
+		os.precision(DoublePrecision);
 		os << ans << " " << minval << " " << maxval << " "
 		   << autorange;
 		ans = os.str();
 	} else if (cmd == CmdSetNorm) {
-		unsigned long minval, maxval;
+		double minval, maxval;
 		int autorange;
 		is >> minval >> maxval >> autorange;
 		m_gldisplay->setNorm(minval, maxval, autorange);
 	} else if (cmd == CmdSetRefreshTime) {
 		is >> m_refresh_time;
+	} else if (cmd == CmdSetZeroCopy) {
+		int active;
+		is >> active;
+		SPSGLDisplayBase::setZeroCopy(active);
+		LocalDisplayList::iterator it, end = m_extra_displays.end();
+		for (it = m_extra_displays.begin(); it != end; ++it)
+			(*it)->setZeroCopy(active);
+	} else if (cmd == CmdSetDecimateMax) {
+		int active;
+		is >> active;
+		SPSGLDisplayBase::setDecimateMax(active);
+		LocalDisplayList::iterator it, end = m_extra_displays.end();
+		for (it = m_extra_displays.begin(); it != end; ++it)
+			(*it)->setDecimateMax(active);
+	} else if (cmd == CmdSetUpdateNotify) {
+		int active;
+		is >> active;
+		SPSGLDisplayBase::setUpdateNotify(active);
+		LocalDisplayList::iterator it, end = m_extra_displays.end();
+		for (it = m_extra_displays.begin(); it != end; ++it)
+			(*it)->setUpdateNotify(active);
 	}
 
 	ans.append("\n");
@@ -529,7 +1050,32 @@ void ForkedSPSGLDisplay::getRates(float *update, float *refresh)
 	is >> *update >> *refresh;
 }
 
-void ForkedSPSGLDisplay::getNorm(unsigned long *minval, unsigned long *maxval,
+void ForkedSPSGLDisplay::getFrameStats(unsigned long *displayed,
+				       unsigned long *skipped,
+				       unsigned long *acquired)
+{
+	string ans = sendChildCmd(CmdList[CmdGetFrameStats]);
+	istringstream is(ans);
+	is >> *displayed >> *skipped >> *acquired;
+}
+
+void ForkedSPSGLDisplay::getUploadStats(unsigned long long *uploaded,
+					unsigned long long *saved)
+{
+	string ans = sendChildCmd(CmdList[CmdGetUploadStats]);
+	istringstream is(ans);
+	is >> *uploaded >> *saved;
+}
+
+void ForkedSPSGLDisplay::getPacingStats(unsigned long *wakeups, 
+					float *interval, float *jitter)
+{
+	string ans = sendChildCmd(CmdList[CmdGetPacingStats]);
+	istringstream is(ans);
+	is >> *wakeups >> *interval >> *jitter;
+}
+
+void ForkedSPSGLDisplay::getNorm(double *minval, double *maxval,
 				 int *autorange)
 {
 	string ans = sendChildCmd(CmdList[CmdGetNorm]);
@@ -538,10 +1084,11 @@ void ForkedSPSGLDisplay::getNorm(unsigned long *minval, unsigned long *maxval,
 	is >> *minval >> *maxval >> *autorange;
 }
 
-void ForkedSPSGLDisplay::setNorm(unsigned long minval, unsigned long maxval,
+void ForkedSPSGLDisplay::setNorm(double minval, double maxval,
 				 int autorange)
 {
 	ostringstream os;
+	os.precision(DoublePrecision);
 	os << CmdList[CmdSetNorm] << " " << minval << " " << maxval
 	   << " " << autorange;
 	sendChildCmd(os.str());
@@ -556,3 +1103,27 @@ void ForkedSPSGLDisplay::setRefreshTime(float refresh_time)
 	m_refresh_time = refresh_time;
 }
 
+void ForkedSPSGLDisplay::setZeroCopy(bool active)
+{
+	ostringstream os;
+	os << CmdList[CmdSetZeroCopy] << " " << int(active);
+	sendChildCmd(os.str());
+	// keep local copy in sync, inherited by the child if not forked yet
+	SPSGLDisplayBase::setZeroCopy(active);
+}
+
+void ForkedSPSGLDisplay::setDecimateMax(bool active)
+{
+	ostringstream os;
+	os << CmdList[CmdSetDecimateMax] << " " << int(active);
+	sendChildCmd(os.str());
+	SPSGLDisplayBase::setDecimateMax(active);
+}
+
+void ForkedSPSGLDisplay::setUpdateNotify(bool active)
+{
+	ostringstream os;
+	os << CmdList[CmdSetUpdateNotify] << " " << int(active);
+	sendChildCmd(os.str());
+	SPSGLDisplayBase::setUpdateNotify(active);
+}
@@ -26,10 +26,14 @@
 #include <QX11Info>
 #include "image.h"
 #include "imageapi.h"
+#include "imageproc.h"
 #include <GL/glx.h>
 #include <GL/glext.h>
 
 #include <math.h>
+#include <sys/select.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
 #include <iostream>
 #include <cstdio>
 using namespace std;
@@ -105,16 +109,17 @@ Image::Image()
 }
 
 
-Image::Image(void *ptr, unsigned width, unsigned height, unsigned depth) 
+Image::Image(void *ptr, unsigned width, unsigned height, unsigned depth,
+	     ImagePixelPtr::Type type) 
 { 
-	setBuffer(ptr, width, height, depth); 
+	setBuffer(ptr, width, height, depth, type); 
 }
 
 
 void Image::setBuffer(void *ptr, unsigned width, unsigned height, 
-		      unsigned depth)
+		      unsigned depth, ImagePixelPtr::Type type)
 {
-	buff.init(ptr, depth);
+	buff.init(ptr, depth, type);
 	w = width;
 	h = height;
 }
@@ -125,20 +130,249 @@ void Image::setTestImage(bool active)
 	
 	for (unsigned int i = 0; i < h; ++i) {
 		for (unsigned int j = 0; j < w; ++j) {
-			float val = 0;
+			double val = 0;
 			if (active)
-				val = float(i + j) * maxVal() / (w + h);
-			p.store(unsigned(val));
+				val = double(i + j) * maxVal() / (w + h);
+			p.store(val);
 			++p;
 		}
 	}
 }
 
+bool Image::getMinMax(double& min_val, double& max_val)
+{
+	unsigned len = nrPixels();
+
+	void *p = buff.vPtr();
+
+	switch (buff.type()) {
+	case ImagePixelPtr::Float:
+		switch (depth()) {
+		case 4: return imageMinMax((float *) p, len, min_val, max_val);
+		case 8: return imageMinMax((double *) p, len, min_val, 
+					   max_val);
+		}
+		break;
+	case ImagePixelPtr::Signed:
+		switch (depth()) {
+		case 1: return imageMinMax((signed char *) p, len, min_val, 
+					   max_val);
+		case 2: return imageMinMax((short *) p, len, min_val, max_val);
+		case 4: return imageMinMax((int *) p, len, min_val, max_val);
+		}
+		break;
+	default:
+		switch (depth()) {
+		case 1: return imageMinMax((unsigned char *) p, len, min_val, 
+					   max_val);
+		case 2: return imageMinMax((unsigned short *) p, len, min_val,
+					   max_val);
+		case 4: return imageMinMax((unsigned int *) p, len, min_val, 
+					   max_val);
+		}
+		break;
+	}
+
+	return false;
+}
+
+// nr_samples = 0 counts all the pixels
+bool Image::getHistogram(ImageHistogram& hist, unsigned long nr_samples)
+{
+	unsigned len = nrPixels();
+	if ((nr_samples == 0) || (nr_samples > len))
+		nr_samples = len;
+
+	void *p = buff.vPtr();
+
+	switch (buff.type()) {
+	case ImagePixelPtr::Float:
+		switch (depth()) {
+		case 4: return imageSampleHistogram((float *) p, len, 
+						    nr_samples, hist);
+		case 8: return imageSampleHistogram((double *) p, len, 
+						    nr_samples, hist);
+		}
+		break;
+	case ImagePixelPtr::Signed:
+		switch (depth()) {
+		case 1: return imageSampleHistogram((signed char *) p, len, 
+						    nr_samples, hist);
+		case 2: return imageSampleHistogram((short *) p, len, 
+						    nr_samples, hist);
+		case 4: return imageSampleHistogram((int *) p, len, 
+						    nr_samples, hist);
+		}
+		break;
+	default:
+		switch (depth()) {
+		case 1: return imageSampleHistogram((unsigned char *) p, len, 
+						    nr_samples, hist);
+		case 2: return imageSampleHistogram((unsigned short *) p, len, 
+						    nr_samples, hist);
+		case 4: return imageSampleHistogram((unsigned int *) p, len, 
+						    nr_samples, hist);
+		}
+		break;
+	}
+
+	return false;
+}
+
+void Image::convert(unsigned short *dst, double min_val, double max_val)
+{
+	if (!isFloat())
+		return;
+
+	if (depth() == 4)
+		imageConvert(buff.fPtr(), nrPixels(), min_val, max_val, dst);
+	else
+		imageConvert(buff.dPtr(), nrPixels(), min_val, max_val, dst);
+}
+
+// scaled to dst_width x dst_height, through the lut: see imageColormap
+void Image::colormap(double min_val, double max_val, const unsigned int *lut,
+		     unsigned int *dst, int dst_width, int dst_height,
+		     int dst_stride)
+{
+	void *p = buff.vPtr();
+
+	switch (buff.type()) {
+	case ImagePixelPtr::Float:
+		switch (depth()) {
+		case 4: imageColormap((float *) p, w, h, min_val, max_val, 
+				      lut, dst, dst_width, dst_height, 
+				      dst_stride);
+			break;
+		case 8: imageColormap((double *) p, w, h, min_val, max_val, 
+				      lut, dst, dst_width, dst_height, 
+				      dst_stride);
+			break;
+		}
+		break;
+	case ImagePixelPtr::Signed:
+		switch (depth()) {
+		case 1: imageColormap((signed char *) p, w, h, min_val, 
+				      max_val, lut, dst, dst_width, 
+				      dst_height, dst_stride);
+			break;
+		case 2: imageColormap((short *) p, w, h, min_val, max_val, 
+				      lut, dst, dst_width, dst_height, 
+				      dst_stride);
+			break;
+		case 4: imageColormap((int *) p, w, h, min_val, max_val, 
+				      lut, dst, dst_width, dst_height, 
+				      dst_stride);
+			break;
+		}
+		break;
+	default:
+		switch (depth()) {
+		case 1: imageColormap((unsigned char *) p, w, h, min_val, 
+				      max_val, lut, dst, dst_width, 
+				      dst_height, dst_stride);
+			break;
+		case 2: imageColormap((unsigned short *) p, w, h, min_val, 
+				      max_val, lut, dst, dst_width, 
+				      dst_height, dst_stride);
+			break;
+		case 4: imageColormap((unsigned int *) p, w, h, min_val, 
+				      max_val, lut, dst, dst_width, 
+				      dst_height, dst_stride);
+			break;
+		}
+		break;
+	}
+}
+
+// only the width x height pixels at (x, y), dst has the image size
+void Image::convert(unsigned short *dst, double min_val, double max_val,
+		    int x, int y, int width, int height)
+{
+	if (!isFloat())
+		return;
+
+	for (int i = y; i < y + height; ++i) {
+		unsigned long offset = (unsigned long) i * w + x;
+		if (depth() == 4)
+			imageConvert(buff.fPtr() + offset, width, min_val, 
+				     max_val, dst + offset);
+		else
+			imageConvert(buff.dPtr() + offset, width, min_val, 
+				     max_val, dst + offset);
+	}
+}
+
+// halves the width x height pixels at (x, y), x and y even, into dst 
+// at (x / 2, y / 2): see imageReduce. dst has the same pixel type
+void Image::reduce(int x, int y, int width, int height, bool use_max,
+		   Image& dst)
+{
+	unsigned long offset = (unsigned long) y * w + x;
+	unsigned long dst_offset = (unsigned long) (y / 2) * dst.w + x / 2;
+	int d = depth();
+	char *p = (char *) buff.vPtr() + offset * d;
+	char *q = (char *) dst.buff.vPtr() + dst_offset * d;
+
+	switch (buff.type()) {
+	case ImagePixelPtr::Float:
+		switch (d) {
+		case 4: imageReduce((float *) p, width, height, w, use_max,
+				    (float *) q, dst.w);
+			break;
+		case 8: imageReduce((double *) p, width, height, w, use_max,
+				    (double *) q, dst.w);
+			break;
+		}
+		break;
+	case ImagePixelPtr::Signed:
+		switch (d) {
+		case 1: imageReduce((signed char *) p, width, height, w, 
+				    use_max, (signed char *) q, dst.w);
+			break;
+		case 2: imageReduce((short *) p, width, height, w, use_max,
+				    (short *) q, dst.w);
+			break;
+		case 4: imageReduce((int *) p, width, height, w, use_max,
+				    (int *) q, dst.w);
+			break;
+		}
+		break;
+	default:
+		switch (d) {
+		case 1: imageReduce((unsigned char *) p, width, height, w, 
+				    use_max, (unsigned char *) q, dst.w);
+			break;
+		case 2: imageReduce((unsigned short *) p, width, height, w, 
+				    use_max, (unsigned short *) q, dst.w);
+			break;
+		case 4: imageReduce((unsigned int *) p, width, height, w, 
+				    use_max, (unsigned int *) q, dst.w);
+			break;
+		}
+		break;
+	}
+}
+
 
 /********************************************************************
  * ImageWidget
  ********************************************************************/
 
+// raw pixels in [0, 1] (or [-1, 1] if signed) scaled to the colormap;
+// non-finite float values get the first color, as in imageConvert
+static const char *ImageFragmentShader =
+	"uniform sampler2D pixels;\n"
+	"uniform sampler1D colormap;\n"
+	"uniform float scale;\n"
+	"uniform float bias;\n"
+	"void main()\n"
+	"{\n"
+	"	float v = texture2D(pixels, gl_TexCoord[0].st).r;\n"
+	"	v = (abs(v) < 3.4e38) ? (v * scale + bias) : 0.0;\n"
+	"	gl_FragColor = texture1D(colormap, clamp(v, 0.0, 1.0));\n"
+	"}\n";
+
 QString ImageWidget::colormapName(ColormapType cmap)
 {
 	switch (cmap) {
@@ -163,28 +397,148 @@ ImageWidget::ColormapType ImageWidget::colormapType(QString name)
 ImageWidget::ImageWidget(QWidget *parent, ColormapType cmap)
 	: QGLWidget(parent)
 {
+	// IMAGE_SWAP_INTERVAL=1 aligns the refresh on the vertical sync
+	QGLFormat format(QGL::DoubleBuffer);
+	QString env = getenv("IMAGE_SWAP_INTERVAL");
+	if (!env.isEmpty())
+		format.setSwapInterval(max(env.toInt(), 0));
 	ImageContext *context;
-	context = new ImageContext(QGLFormat(QGL::DoubleBuffer), this);
+	context = new ImageContext(format, this);
 	setContext(context);
 
 	b_type = GL_UNSIGNED_BYTE;
+	w_width = w_height = 0;
 	x = y = 0;
 	factor = 0;
 	min_val = max_val = 0;
 	auto_range = 1;
+	// the autorange can ignore the hot/dead pixels: Percentile takes
+	// the IMAGE_PERCENTILES (low,high) of the histogram, Sampled
+	// estimates them from IMAGE_SAMPLES pixels
+	auto_range_mode = AutoMinMax;
+	env = getenv("IMAGE_AUTORANGE");
+	if (env == "Percentile")
+		auto_range_mode = AutoPercentile;
+	else if (env == "Sampled")
+		auto_range_mode = AutoSampled;
+	nr_samples = DefaultNrSamples;
+	env = getenv("IMAGE_SAMPLES");
+	if (!env.isEmpty())
+		nr_samples = max(env.toULong(), 1UL);
+	low_percentile = 0.1;
+	high_percentile = 99.9;
+	env = getenv("IMAGE_PERCENTILES");
+	if (!env.isEmpty()) {
+		QStringList l = env.split(',');
+		low_percentile = min(max(l[0].toDouble(), 0.0), 100.0);
+		if (l.size() > 1)
+			high_percentile = min(max(l[1].toDouble(), 
+						  low_percentile), 100.0);
+	}
+	hist_valid = 0;
 
 	must_resize = 0;
 	must_normalize = 0;
+	must_convert = 0;
+	must_compare = 0;
 	normalize_rate = 1.0;
+	conv_min = conv_max = 0;
+	conv_valid = 0;
+	pt_scale = pt_offset = 0;
+	upload_bytes = saved_bytes = 0;
+
+	offscreen = 0;
+	offscreen_width = offscreen_height = 0;
+	offscreen_init = 0;
+	fbo = NULL;
+	rendered_frame = NULL;
+	rendered_width = rendered_height = 0;
 
 	colormap = cmap;	
 	mapsize = 256;
 
 	draw_mode = GL_LUMINANCE;
-	QString env = getenv("IMAGE_DRAW_MODE");
+	env = getenv("IMAGE_DRAW_MODE");
 	if (env == "ColorIndex")
 		draw_mode = GL_COLOR_INDEX;
 
+	render_mode = Shader;
+	env = getenv("IMAGE_RENDER_MODE");
+	if (env == "DrawPixels")
+		render_mode = DrawPixels;
+	else if (env == "Texture")
+		render_mode = Texture;
+	else if (env == "Software")
+		render_mode = Software;
+	else if (env == "Remote")
+		render_mode = Remote;
+	// Software is chosen if GL is missing, Remote if it is indirect
+	render_mode_auto = env.isEmpty();
+	soft_image = NULL;
+	soft_gc = 0;
+	soft_x = soft_y = -1;
+	// the X server reads the pixels from shared memory if it is local
+	soft_use_shm = 1;
+	env = getenv("IMAGE_XSHM");
+	if ((env == "0") || (env == "No"))
+		soft_use_shm = 0;
+	soft_shminfo.shmaddr = NULL;
+	// Remote mode sends 8-bit color indexes, or 24-bit RGB
+	remote_format = GL_COLOR_INDEX;
+	env = getenv("IMAGE_REMOTE_FORMAT");
+	if (env == "RGB")
+		remote_format = GL_RGB;
+	tiles_width = tiles_height = 0;
+	tiles_format = 0;
+	tile_size = DefaultTileSize;
+	env = getenv("IMAGE_TILE_SIZE");
+	if (!env.isEmpty())
+		tile_size = max(env.toInt(), 1);
+	// only the tiles changed by a new frame are uploaded
+	dirty_tiles = 1;
+	env = getenv("IMAGE_DIRTY_TILES");
+	if ((env == "0") || (env == "No"))
+		dirty_tiles = 0;
+	// 0 uploads all the dirty tiles in each paint
+	max_tile_uploads = 0;
+	env = getenv("IMAGE_TILE_UPLOADS");
+	if (!env.isEmpty())
+		max_tile_uploads = max(env.toInt(), 0);
+	// zoomed out images are drawn from a reduced level: Max keeps the
+	// hot pixels, Mean is smoother, No draws the full image
+	tiles_level = 0;
+	use_pyramid = 1;
+	pyramid_max = 1;
+	env = getenv("IMAGE_PYRAMID");
+	if ((env == "0") || (env == "No"))
+		use_pyramid = 0;
+	else if (env == "Mean")
+		pyramid_max = 0;
+	program = 0;
+	program_scale = program_offset = -1;
+	shader_scale = 1;
+	shader_offset = 0;
+	cmap_texture = 0;
+	must_upload = 0;
+
+	// asynchronous texture upload through a ring of pixel buffers
+	nr_pbo = 2;
+	env = getenv("IMAGE_NR_PBO");
+	if (!env.isEmpty())
+		nr_pbo = min(max(env.toInt(), 0), int(MaxPixelBuffers));
+	pbo_index = 0;
+	for (int i = 0; i < MaxPixelBuffers; ++i) {
+		pbo[i] = 0;
+		pbo_size[i] = 0;
+	}
+
+	if (!isValid() && (render_mode != Software)) {
+		cerr << "No GL context. Using Software render mode." << endl;
+		render_mode = Software;
+	}
+	if ((render_mode == Software) || (render_mode == Remote))
+		nr_pbo = 0;
+
 	x11nrcolors = 0;
 
 	test_active = 0;
@@ -195,11 +549,27 @@ ImageWidget::ImageWidget(QWidget *parent, ColormapType cmap)
 
 ImageWidget::~ImageWidget()
 {
+	if (!tiles.empty() || nr_pbo || program || fbo) {
+		makeCurrent();
+		delete fbo;
+		deleteTiles();
+		if (nr_pbo)
+			glDeleteBuffers(nr_pbo, pbo);	// 0 names are ignored
+		if (program) {
+			glDeleteProgram(program);
+			glDeleteTextures(1, &cmap_texture);
+		}
+	}
 	if (x11nrcolors > 0) {
 		XFreeColormap(QX11Info::display(), x11colormap);
 		delete [] x11cmap;
 	}
 	free(testimage.ptr().vPtr());
+	free(dispimage.ptr().vPtr());
+	free(rendered_frame);
+	freeSoftImage();
+	if (soft_gc)
+		XFreeGC(QX11Info::display(), soft_gc);
 }
 
 void ImageWidget::setColormap(ColormapType cmap)
@@ -230,6 +600,20 @@ void ImageWidget::setColormap(ColormapType cmap)
 		}
 	}
 
+	if (render_mode == Shader) {
+		setShaderColormap(map, mapsize);
+		return;
+	} else if (render_mode == Software) {
+		setSoftwareColormap(map, mapsize);
+		return;
+	} else if (render_mode == Remote) {
+		setRemoteColormap(map, mapsize);
+		return;
+	}
+
+	// the colormap is applied when the texture is uploaded
+	must_upload = 1;
+
 	if (0 && checkX11Colormap(map, mapsize)) {
 		setX11Colormap(map, mapsize);
 		return;
@@ -252,16 +636,26 @@ void ImageWidget::setColormap(ColormapType cmap)
 	}
 }
 	
+bool ImageWidget::hasGLExtension(const char *ext)
+{
+	const char *extensions = (const char *) glGetString(GL_EXTENSIONS);
+	if (!extensions)
+		return false;
+
+	int len = strlen(ext);
+	const char *ptr = extensions;
+	while ((ptr = strstr(ptr, ext)) != NULL) {
+		bool start = (ptr == extensions) || (ptr[-1] == ' ');
+		ptr += len;
+		if (start && (!*ptr || (*ptr == ' ')))
+			return true;
+	}
+	return false;
+}
+
 int ImageWidget::checkColorTableColormap(float map[][4], int UNUSED(size))
 {
-	char *extensions = (char *) glGetString(GL_EXTENSIONS);
-	const char *ext = "GL_ARB_imaging";
-	char *ptr = strstr(extensions, ext);
-	if (!ptr)
-		return 0;
-
-	ptr += strlen(ext);
-	if (*ptr && (*ptr != ' '))
+	if (!hasGLExtension("GL_ARB_imaging"))
 		return 0;
 
 	int tab = GL_PROXY_COLOR_TABLE;
@@ -396,7 +790,31 @@ void ImageWidget::initializeGL()
 	if (Image::debug)
 		cout << "In initializeGL" << endl;
 
+	// indirect GLX sends each frame through the X protocol
+	GLXContext glx_context = glXGetCurrentContext();
+	if (render_mode_auto && !offscreen && glx_context && 
+	    !glXIsDirect(QX11Info::display(), glx_context)) {
+		cerr << "Indirect GLX rendering. "
+		     << "Using Remote render mode." << endl;
+		render_mode = Remote;
+		nr_pbo = 0;
+	}
+
+	if ((render_mode == Shader) && !initShader()) {
+		cerr << "GLSL or GL_ARB_texture_float not found. "
+		     << "Using Texture render mode." << endl;
+		render_mode = Texture;
+	}
 	setColormap(colormap);
+	initPixelBuffers();
+
+	// power of two tiles within the texture size limit
+	GLint max_size;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+	GLsizei size = 1;
+	while ((size * 2 <= tile_size) && (size * 2 <= max_size))
+		size *= 2;
+	tile_size = size;
 
 	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 	glClearColor(0.0, 0.0, 0.0, 0.0);
@@ -464,21 +882,525 @@ void ImageWidget::paintGL()
 		normalize(must_normalize);
 		must_normalize = 0;
 
-		glDrawPixels(image.width(), image.height(), draw_mode, b_type, 
-			     image.ptr().vPtr());
+		Image& draw_image = getDrawImage();
+
+		// repaints without new data or new normalisation only
+		// draw the tiles already uploaded
+		if (render_mode == Remote) {
+			drawRemote(image);
+		} else if (render_mode != DrawPixels) {
+			updateTiles(image, draw_image);
+			if (uploadTiles(draw_image) > 0)
+				requestUpdate();  // next tiles, next paint
+			drawTiles(draw_image);
+		} else {
+			if ((&draw_image == &dispimage) && must_convert)
+				image.convert(draw_image.ptr().sPtr(), 
+					      min_val, max_val);
+			conv_valid = 0;
+			must_convert = must_compare = must_upload = 0;
+			glDrawPixels(draw_image.width(), draw_image.height(), 
+				     draw_mode, b_type, 
+				     draw_image.ptr().vPtr());
+		}
 	}
 
 	glFlush();
 }
 
+// the pixel transfer normalisation and colormap are applied by the 
+// upload, as they were by glDrawPixels, except in Shader mode where 
+// the raw pixels are uploaded
+void ImageWidget::getTextureFormat(Image& draw_image, GLint& format,
+				   GLenum& data_format, GLenum& type)
+{
+	format = GL_RGB8;
+	data_format = draw_mode;
+	type = b_type;
+	if (render_mode == Shader) {
+		format = rawTextureFormat(draw_image);
+		data_format = GL_LUMINANCE;
+		if (draw_image.isFloat())
+			type = GL_FLOAT;
+	}
+}
+
+// the image, or its pyramid level, is split in tiles of at most 
+// tile_size, each one in a power of two texture with the tile in the 
+// lower left corner
+void ImageWidget::reallocTiles(Image& draw_image, GLint format, int level)
+{
+	deleteTiles();
+	reallocPyramid(draw_image, level);
+
+	Image& level_image = level ? *pyramid[level - 1] : draw_image;
+	GLsizei width = level_image.width();
+	GLsizei height = level_image.height();
+	for (GLint ty = 0; ty < height; ty += tile_size) {
+		for (GLint tx = 0; tx < width; tx += tile_size) {
+			Tile tile;
+			tile.x = tx;
+			tile.y = ty;
+			tile.width = min(tile_size, width - tx);
+			tile.height = min(tile_size, height - ty);
+			tile.tex_width = tile.tex_height = 1;
+			while (tile.tex_width < tile.width)
+				tile.tex_width *= 2;
+			while (tile.tex_height < tile.height)
+				tile.tex_height *= 2;
+			tile.dirty = 1;
+			tile.loaded = 0;
+			tile.hash = 0;
+			tile.hashed = 0;
+
+			glGenTextures(1, &tile.texture);
+			glBindTexture(GL_TEXTURE_2D, tile.texture);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, 
+					GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, 
+					GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, 
+					GL_CLAMP);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, 
+					GL_CLAMP);
+			glTexImage2D(GL_TEXTURE_2D, 0, format, tile.tex_width,
+				     tile.tex_height, 0, GL_RGB, 
+				     GL_UNSIGNED_BYTE, NULL);
+			tiles.push_back(tile);
+		}
+	}
+	glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+
+	tiles_width = draw_image.width();
+	tiles_height = draw_image.height();
+	tiles_format = format;
+	tiles_level = level;
+	if (Image::debug)
+		cout << "Tiles: " << tiles.size() << " of " << tile_size 
+		     << "x" << tile_size << ", level " << level << endl;
+}
+
+void ImageWidget::deleteTiles()
+{
+	for (unsigned i = 0; i < tiles.size(); ++i)
+		glDeleteTextures(1, &tiles[i].texture);
+	tiles.clear();
+	tiles_width = tiles_height = 0;
+	deletePyramid();
+}
+
+// the level drawn with a zoom in [1, 2): each of its pixels is shown,
+// so that small features do not flicker in and out
+int ImageWidget::pyramidLevel(Image& draw_image)
+{
+	int level = 0;
+	if (!use_pyramid)
+		return level;
+	unsigned width = draw_image.width(), height = draw_image.height();
+	while ((level < MaxPyramidLevels) && (factor * (1 << level) < 1) &&
+	       ((width > 1) || (height > 1))) {
+		width = (width + 1) / 2;
+		height = (height + 1) / 2;
+		++level;
+	}
+	return level;
+}
+
+// levels 1 to nr_levels, of the draw image pixel type
+void ImageWidget::reallocPyramid(Image& draw_image, int nr_levels)
+{
+	deletePyramid();
+
+	unsigned width = draw_image.width(), height = draw_image.height();
+	unsigned depth = draw_image.depth();
+	for (int i = 0; i < nr_levels; ++i) {
+		width = (width + 1) / 2;
+		height = (height + 1) / 2;
+		void *buffer = malloc(width * height * depth);
+		if (!buffer)
+			throw exception();
+		pyramid.push_back(new Image(buffer, width, height, depth, 
+					    draw_image.type()));
+	}
+}
+
+void ImageWidget::deletePyramid()
+{
+	for (unsigned i = 0; i < pyramid.size(); ++i) {
+		free(pyramid[i]->ptr().vPtr());
+		delete pyramid[i];
+	}
+	pyramid.clear();
+}
+
+void ImageWidget::setTilesDirty()
+{
+	for (unsigned i = 0; i < tiles.size(); ++i)
+		tiles[i].dirty = 1;
+}
+
+// marks the tiles to upload and converts the float pixels. A new frame
+// only dirties the tiles whose hash changed, a new normalisation or 
+// colormap needs all of them
+void ImageWidget::updateTiles(Image& image, Image& draw_image)
+{
+	GLint format;
+	GLenum data_format, type;
+	getTextureFormat(draw_image, format, data_format, type);
+	int level = pyramidLevel(draw_image);
+	if ((GLsizei(draw_image.width()) != tiles_width) || 
+	    (GLsizei(draw_image.height()) != tiles_height) ||
+	    (format != tiles_format) || (level != tiles_level))
+		reallocTiles(draw_image, format, level);
+
+	bool converted = (&draw_image == &dispimage);
+	bool full_convert = (converted && must_convert && 
+			     (!conv_valid || (conv_min != min_val) || 
+			      (conv_max != max_val)));
+	if (must_upload || full_convert)
+		setTilesDirty();
+	if (must_compare) {
+		if (dirty_tiles)
+			compareTiles(image, draw_image);
+		else
+			setTilesDirty();
+	}
+
+	if (converted && must_convert) {
+		if (full_convert)
+			image.convert(draw_image.ptr().sPtr(), min_val, 
+				      max_val);
+		else
+			convertTiles(image);
+		conv_min = min_val;
+		conv_max = max_val;
+		conv_valid = 1;
+	}
+
+	must_convert = must_compare = must_upload = 0;
+}
+
+void ImageWidget::compareTiles(Image& image, Image& draw_image)
+{
+	int depth = image.depth();
+	long stride = (long) image.width() * depth;
+	const char *ptr = (const char *) image.ptr().vPtr();
+	for (unsigned i = 0; i < tiles.size(); ++i) {
+		Tile& tile = tiles[i];
+		int tx, ty, width, height;
+		tileRect(tile, draw_image, tx, ty, width, height);
+		const char *tile_ptr = ptr + ty * stride + tx * depth;
+		unsigned long long hash = imageHash(tile_ptr, width * depth,
+						    height, stride);
+		if (!tile.hashed || (hash != tile.hash))
+			tile.dirty = 1;
+		else if (!tile.dirty)
+			saved_bytes += tileBytes(tile, draw_image);
+		tile.hash = hash;
+		tile.hashed = 1;
+	}
+}
+
+// the dispimage pixels of the other tiles are still valid
+void ImageWidget::convertTiles(Image& image)
+{
+	for (unsigned i = 0; i < tiles.size(); ++i) {
+		Tile& tile = tiles[i];
+		if (!tile.dirty)
+			continue;
+		int tx, ty, width, height;
+		tileRect(tile, dispimage, tx, ty, width, height);
+		image.convert(dispimage.ptr().sPtr(), min_val, max_val, tx, 
+			      ty, width, height);
+	}
+}
+
+// the draw image pixels covered by a tile of the pyramid level
+void ImageWidget::tileRect(Tile& tile, Image& draw_image, int& tx, 
+			   int& ty, int& width, int& height)
+{
+	tx = tile.x << tiles_level;
+	ty = tile.y << tiles_level;
+	width = min(tile.width << tiles_level, int(draw_image.width()) - tx);
+	height = min(tile.height << tiles_level, 
+		     int(draw_image.height()) - ty);
+}
+
+// each level of the tile is rebuilt from the previous one
+void ImageWidget::reduceTile(Tile& tile, Image& draw_image)
+{
+	for (int level = 1; level <= tiles_level; ++level) {
+		Image& src = (level > 1) ? *pyramid[level - 2] : draw_image;
+		int shift = tiles_level - level + 1;
+		int tx = tile.x << shift, ty = tile.y << shift;
+		int width = min(tile.width << shift, int(src.width()) - tx);
+		int height = min(tile.height << shift, 
+				 int(src.height()) - ty);
+		src.reduce(tx, ty, width, height, pyramid_max, 
+			   *pyramid[level - 1]);
+	}
+}
+
+unsigned long long ImageWidget::tileBytes(Tile& tile, Image& draw_image)
+{
+	return ((unsigned long long) tile.width * tile.height * 
+		draw_image.depth());
+}
+
+// uploads the dirty tiles, at most max_tile_uploads if not 0, in image
+// order. Returns the number of tiles still dirty
+int ImageWidget::uploadTiles(Image& draw_image)
+{
+	int nr_tiles = tiles.size();
+	int nr_dirty = 0, nr_upload = 0;
+	int first_row = 0, end_row = 0;
+	for (int i = 0; i < nr_tiles; ++i) {
+		Tile& tile = tiles[i];
+		if (!tile.dirty)
+			continue;
+		if (!max_tile_uploads || (nr_upload < max_tile_uploads)) {
+			if (!nr_upload++)
+				first_row = tile.y;
+			end_row = max(end_row, tile.y + tile.height);
+			if (tiles_level)
+				reduceTile(tile, draw_image);
+		}
+		++nr_dirty;
+	}
+	if (!nr_upload)
+		return 0;
+
+	// from here the tiles are in the level image
+	Image& level_image = tiles_level ? *pyramid[tiles_level - 1] 
+					 : draw_image;
+
+	GLint format;
+	GLenum data_format, type;
+	getTextureFormat(draw_image, format, data_format, type);
+
+	// only the rows of the uploaded tiles go through the pixel buffer
+	const char *data = (const char *) level_image.ptr().vPtr();
+	int data_row = 0;
+	if (nr_pbo) {
+		data_row = first_row;
+		data = (const char *) fillPixelBuffer(level_image, data_row,
+						      end_row - first_row);
+	}
+
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, level_image.width());
+	for (int i = 0, n = 0; (i < nr_tiles) && (n < nr_upload); ++i) {
+		Tile& tile = tiles[i];
+		if (!tile.dirty)
+			continue;
+		glPixelStorei(GL_UNPACK_SKIP_PIXELS, tile.x);
+		glPixelStorei(GL_UNPACK_SKIP_ROWS, tile.y - data_row);
+		glBindTexture(GL_TEXTURE_2D, tile.texture);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, tile.width, 
+				tile.height, data_format, type, data);
+		tile.dirty = 0;
+		tile.loaded = 1;
+		upload_bytes += tileBytes(tile, level_image);
+		++n;
+	}
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+	glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	return nr_dirty - nr_upload;
+}
+
+void ImageWidget::initPixelBuffers()
+{
+	if (!nr_pbo || (render_mode == DrawPixels))
+		return;
+
+	if (!hasGLExtension("GL_ARB_pixel_buffer_object")) {
+		cerr << "GL_ARB_pixel_buffer_object not found. "
+		     << "Using synchronous texture upload." << endl;
+		nr_pbo = 0;
+		return;
+	}
+
+	glGenBuffers(nr_pbo, pbo);
+}
+
+// copy the image rows in the next pixel buffer of the ring and leave it
+// bound: the tiles are then filled from it without blocking, while the 
+// other buffers can still be in use by the previous uploads. Returns 
+// the pointer to the first row, set to 0 if the image itself is used
+const void *ImageWidget::fillPixelBuffer(Image& draw_image, int& row, 
+					 int nr_rows)
+{
+	GLsizeiptr row_size = draw_image.size() / draw_image.height();
+	GLsizeiptr size = row_size * nr_rows;
+	const char *src = (const char *) draw_image.ptr().vPtr();
+	int i = pbo_index;
+	pbo_index = (pbo_index + 1) % nr_pbo;
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo[i]);
+	if (size > pbo_size[i]) {
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, 
+			     GL_STREAM_DRAW);
+		pbo_size[i] = size;
+	}
+
+	void *ptr = glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+	if (!ptr) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		row = 0;
+		return src;
+	}
+	memcpy(ptr, src + row * row_size, size);
+	if (!glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER)) {
+		// buffer contents lost
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		row = 0;
+		return src;
+	}
+
+	return NULL;	// offset in the bound buffer
+}
+
+// same place and zoom as glDrawPixels in calcResize: (x, y) is the
+// upper left corner, the first row is drawn on top. The tile edges
+// are computed the same way on both sides, so no seam is left. A
+// pyramid level is drawn over the draw image pixels it covers
+void ImageWidget::drawTiles(Image& draw_image)
+{
+	if (render_mode == Shader) {
+		glUseProgram(program);
+		glUniform1f(program_scale, shader_scale);
+		glUniform1f(program_offset, shader_offset);
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_1D, cmap_texture);
+		glActiveTexture(GL_TEXTURE0);
+	}
+
+	glEnable(GL_TEXTURE_2D);
+	for (unsigned i = 0; i < tiles.size(); ++i) {
+		Tile& tile = tiles[i];
+		if (!tile.loaded)
+			continue;
+
+		int tx, ty, width, height;
+		tileRect(tile, draw_image, tx, ty, width, height);
+		GLfloat x0 = x + tx * factor;
+		GLfloat x1 = x + (tx + width) * factor;
+		GLfloat y0 = y - ty * factor;
+		GLfloat y1 = y - (ty + height) * factor;
+		GLfloat s = GLfloat(width) / (tile.tex_width << tiles_level);
+		GLfloat t = GLfloat(height) / 
+			    (tile.tex_height << tiles_level);
+
+		glBindTexture(GL_TEXTURE_2D, tile.texture);
+		glBegin(GL_QUADS);
+		glTexCoord2f(0, 0); glVertex2f(x0, y0);
+		glTexCoord2f(s, 0); glVertex2f(x1, y0);
+		glTexCoord2f(s, t); glVertex2f(x1, y1);
+		glTexCoord2f(0, t); glVertex2f(x0, y1);
+		glEnd();
+	}
+	glDisable(GL_TEXTURE_2D);
+
+	if (render_mode == Shader)
+		glUseProgram(0);
+}
+
+// GLSL 1.10 and float textures are available from Mesa llvmpipe on
+bool ImageWidget::initShader()
+{
+	const char *version = (const char *) glGetString(GL_VERSION);
+	if (!version || (atoi(version) < 2) || 
+	    !hasGLExtension("GL_ARB_texture_float"))
+		return false;
+
+	GLint ok = 0;
+	GLuint shader = glCreateShader(GL_FRAGMENT_SHADER);
+	glShaderSource(shader, 1, &ImageFragmentShader, NULL);
+	glCompileShader(shader);
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+	if (ok) {
+		program = glCreateProgram();
+		glAttachShader(program, shader);
+		glLinkProgram(program);
+		glGetProgramiv(program, GL_LINK_STATUS, &ok);
+	}
+	glDeleteShader(shader);	// freed with the program
+	if (!ok) {
+		cerr << "Could not build the image fragment shader" << endl;
+		if (program)
+			glDeleteProgram(program);
+		program = 0;
+		return false;
+	}
+
+	glUseProgram(program);
+	glUniform1i(glGetUniformLocation(program, "pixels"), 0);
+	glUniform1i(glGetUniformLocation(program, "colormap"), 1);
+	glUseProgram(0);
+	program_scale = glGetUniformLocation(program, "scale");
+	program_offset = glGetUniformLocation(program, "bias");
+
+	glGenTextures(1, &cmap_texture);
+	glBindTexture(GL_TEXTURE_1D, cmap_texture);
+	glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	return true;
+}
+
+// 8 and 16-bit unsigned pixels keep their precision in normalized
+// textures, the other types are converted to float by GL
+GLint ImageWidget::rawTextureFormat(Image& draw_image)
+{
+	if (draw_image.isFloat() || draw_image.isSigned() || 
+	    (draw_image.depth() == 4))
+		return GL_LUMINANCE32F_ARB;
+	return (draw_image.depth() == 1) ? GL_LUMINANCE8 : GL_LUMINANCE16;
+}
+
+// only the uniforms change: the texture is not uploaded again
+void ImageWidget::setShaderNorm(Image& image)
+{
+	// images converted in dispimage are already scaled
+	if (&getDrawImage() != &image) {
+		shader_scale = 1;
+		shader_offset = 0;
+		return;
+	}
+
+	// GL maps the raw values to [0, 1] ([-1, 1] if signed) with maxVal()
+	double range = max_val - min_val;
+	if (range > 0) {
+		shader_scale = float(image.maxVal() / range);
+		shader_offset = float(-min_val / range);
+	} else {
+		shader_scale = 1;
+		shader_offset = float(-min_val / image.maxVal());
+	}
+}
+
+void ImageWidget::setShaderColormap(float map[][4], int size)
+{
+	// the texture is created in initializeGL, which loads it again
+	if (!cmap_texture)
+		return;
+
+	makeCurrent();
+	glBindTexture(GL_TEXTURE_1D, cmap_texture);
+	glTexImage1D(GL_TEXTURE_1D, 0, GL_RGBA8, size, 0, GL_RGBA, GL_FLOAT, 
+		     map);
+}
 
 int ImageWidget::setBuffer(void *ptr, int width, int height, int depth,
-			   bool do_update)
+			   ImagePixelPtr::Type type, bool do_update)
 {
 	if (!ptr && !width && !height && !depth) {
 		if (realimage.isValid()) {
 			realimage.setBuffer(NULL, 0, 0, 0);
 			reallocTestImage();
+			reallocDispImage();
 			if (w_width && w_height)
 				updateImage(false);
 		}
@@ -488,21 +1410,41 @@ int ImageWidget::setBuffer(void *ptr, int width, int height, int depth,
 	if (!ptr || !width || !height)
 		return -1;
 
-	switch (depth) {
-	case 1:	b_type = GL_UNSIGNED_BYTE; break;
-	case 2: b_type = GL_UNSIGNED_SHORT; break;
-	case 4: b_type = GL_UNSIGNED_INT; break;
-	default:
-		return -1;
+	if (type == ImagePixelPtr::Float) {
+		// converted to 16-bit display range in paintGL
+		if ((depth != 4) && (depth != 8))
+			return -1;
+		b_type = GL_UNSIGNED_SHORT;
+	} else if (type == ImagePixelPtr::Signed) {
+		// GL maps signed values to [-1, 1]: see normalize
+		switch (depth) {
+		case 1:	b_type = GL_BYTE; break;
+		case 2: b_type = GL_SHORT; break;
+		case 4: b_type = GL_INT; break;
+		default:
+			return -1;
+		}
+	} else {
+		switch (depth) {
+		case 1:	b_type = GL_UNSIGNED_BYTE; break;
+		case 2: b_type = GL_UNSIGNED_SHORT; break;
+		case 4: b_type = GL_UNSIGNED_INT; break;
+		default:
+			return -1;
+		}
 	}
 
 	bool first_time = !realimage.isValid();
 	bool size_changed = ((width  != int(realimage.width())) || 
 			     (height != int(realimage.height())));
+	bool type_changed = ((depth != int(realimage.depth())) || 
+			     (type != realimage.type()));
 
-	realimage.setBuffer(ptr, width, height, depth);
-	if (test_active && (first_time || size_changed))
+	realimage.setBuffer(ptr, width, height, depth, type);
+	if (test_active && (first_time || size_changed || type_changed))
 		reallocTestImage();
+	if (first_time || size_changed || type_changed)
+		reallocDispImage();
 
 	if (!w_width || !w_height) {
 		if (Image::debug) 
@@ -530,14 +1472,35 @@ void ImageWidget::reallocTestImage()
 	if (!test_buffer)
 		throw exception();
 	testimage.setBuffer(test_buffer, realimage.width(), 
-			    realimage.height(), realimage.depth());
+			    realimage.height(), realimage.depth(),
+			    realimage.type());
 	testimage.setTestImage(test_active);
 }
 
+void ImageWidget::reallocDispImage()
+{
+	free(dispimage.ptr().vPtr());
+	dispimage.setBuffer(NULL, 0, 0, 0);
+	conv_valid = 0;
+	if (!realimage.isValid() || !realimage.isFloat())
+		return;
+
+	int size = realimage.nrPixels() * sizeof(unsigned short);
+	void *disp_buffer = malloc(size);
+	if (!disp_buffer)
+		throw exception();
+	dispimage.setBuffer(disp_buffer, realimage.width(), 
+			    realimage.height(), sizeof(unsigned short));
+	must_convert = 1;
+}
+
 void ImageWidget::updateImage(bool force_norm)
 {
+	hist_valid = 0;
 	if (force_norm)
 		must_normalize = 1;
+	must_convert = 1;
+	must_compare = 1;
 	updateGL();
 }
 
@@ -546,10 +1509,21 @@ Image& ImageWidget::getActiveImage()
 	return *(test_active ? &testimage : &realimage);
 }
 
+// float images are converted to 16-bit, except in Shader mode where
+// only double images are
+Image& ImageWidget::getDrawImage()
+{
+	Image& image = getActiveImage();
+	if (!image.isFloat())
+		return image;
+	if ((render_mode == Shader) && (image.depth() == 4))
+		return image;
+	return dispimage;
+}
+
 void ImageWidget::normalize(bool force)
 {
 	Image& image = getActiveImage();
-	ImagePixelPtr ptr = image.ptr();
 	int i, len = image.nrPixels();
 
 	if (len == 0)
@@ -558,22 +1532,50 @@ void ImageWidget::normalize(bool force)
 	if (!normalize_rate.isTime() && !force)
 		return;
 
-	GLuint abs_max_val = image.maxVal();
 	if (auto_range) {
-		max_val = 0;
-		min_val = abs_max_val;
-
-		for (i = 0; i < len; ++i, ++ptr) {
-			unsigned val = *ptr;
-			if (val > max_val)
-				max_val = val;
-			if (val < min_val)
-				min_val = val;
+		bool found;
+		if (auto_range_mode == AutoMinMax) {
+			found = image.getMinMax(min_val, max_val);
+		} else {
+			// a forced normalization counts all the pixels
+			const ImageHistogram *hist = &sample_hist;
+			if ((auto_range_mode == AutoSampled) && !force) {
+				if (!image.getHistogram(sample_hist, 
+							nr_samples))
+					sample_hist.nr_pixels = 0;
+			} else {
+				hist = &getHistogram();
+			}
+			found = (hist->nr_pixels > 0);
+			min_val = imageHistPercentile(*hist, 
+						      low_percentile / 100);
+			max_val = imageHistPercentile(*hist, 
+						      high_percentile / 100);
 		}
+		if (!found)
+			min_val = max_val = 0;
+		must_convert = 1;
 	}
 
-	float fmin_val = float(min_val) / abs_max_val;
-	float fmax_val = float(max_val) / abs_max_val;
+	if (render_mode == Shader) {
+		setShaderNorm(image);
+		return;
+	} else if ((render_mode == Software) || (render_mode == Remote)) {
+		return;
+	}
+
+	// float images are drawn already scaled to the full 16-bit range;
+	// GL maps signed values with maxVal() of the positive range
+	double draw_min_val = min_val;
+	double abs_max_val = image.maxVal();
+	if (image.isFloat()) {
+		draw_min_val = 0;
+		abs_max_val = ImageDisplayMax;
+	}
+
+	float fmin_val = float(draw_min_val / abs_max_val);
+	float fmax_val = float(image.isFloat() ? 1.0 : 
+			       (max_val / abs_max_val));
 	float scale = 1;
 	if (fmin_val != fmax_val)
 		scale = 1.0 / (fmax_val - fmin_val);
@@ -587,11 +1589,17 @@ void ImageWidget::normalize(bool force)
 	glPixelTransferf(GL_BLUE_SCALE,   scale);
 	glPixelTransferf(GL_BLUE_BIAS,    foffset);
 
+	// the tiles are uploaded again only if the transfer changed
+	if ((scale != pt_scale) || (foffset != pt_offset))
+		must_upload = 1;
+	pt_scale = scale;
+	pt_offset = foffset;
+
 	scale *= float(mapsize) / abs_max_val;
 	for (i = -16; i < 16; i++)
 		if (int(scale / pow(2.0, i)) == 1)
 			break;
-	int offset = -int(min_val * pow(2.0, i));
+	int offset = -int(draw_min_val * pow(2.0, i));
 
 	/* for color index */
 	glPixelTransferi(GL_INDEX_SHIFT,  i);
@@ -609,8 +1617,18 @@ void ImageWidget::setTestImage(bool active)
 	}
 }
 
-void ImageWidget::getNorm(unsigned long *minval, unsigned long *maxval, 
-			  int *autorange)
+// computed once per frame, for the autorange and any other user
+const ImageHistogram& ImageWidget::getHistogram()
+{
+	if (!hist_valid) {
+		if (!getActiveImage().getHistogram(histogram))
+			histogram.nr_pixels = 0;
+		hist_valid = 1;
+	}
+	return histogram;
+}
+
+void ImageWidget::getNorm(double *minval, double *maxval, int *autorange)
 {
 	if (minval)
 		*minval = min_val;
@@ -620,15 +1638,412 @@ void ImageWidget::getNorm(unsigned long *minval, unsigned long *maxval,
 		*autorange = auto_range;
 }
 
-void ImageWidget::setNorm(unsigned long minval, unsigned long maxval, 
-			  int autorange)
+void ImageWidget::setNorm(double minval, double maxval, int autorange)
 {
 	min_val = minval;
 	max_val = maxval;
 	auto_range = autorange;
+	if ((render_mode == Shader) || (render_mode == Software)) {
+		// pixels are uploaded again only if converted in dispimage
+		must_normalize = 1;
+		must_convert = 1;
+		updateGL();
+		return;
+	}
 	updateImage(true);
 }
 
+void ImageWidget::getViewSize(int *width, int *height)
+{
+	if (width)
+		*width = w_width;
+	if (height)
+		*height = w_height;
+}
+
+// bytes of texture uploaded, and not uploaded as the tiles did not 
+// change
+void ImageWidget::getUploadStats(unsigned long long *uploaded,
+				 unsigned long long *saved)
+{
+	if (uploaded)
+		*uploaded = upload_bytes;
+	if (saved)
+		*saved = saved_bytes;
+}
+
+// a hidden widget does not get paint events
+void ImageWidget::requestUpdate()
+{
+	if (offscreen)
+		QTimer::singleShot(0, this, SLOT(updateGL()));
+	else
+		update();
+}
+
+// draw in a framebuffer object of width x height, or of the image 
+// size if 0, instead of the window. The widget must not be shown
+void ImageWidget::setOffscreen(int width, int height)
+{
+	offscreen = 1;
+	offscreen_width = max(width, 0);
+	offscreen_height = max(height, 0);
+}
+
+// same steps as QGLWidget::glDraw, in the framebuffer object
+void ImageWidget::glDraw()
+{
+	if (render_mode == Software) {
+		drawSoftware();
+		return;
+	} else if (!offscreen) {
+		QGLWidget::glDraw();
+		return;
+	}
+
+	if (!isValid())
+		return;
+	makeCurrent();
+	if (!QGLFramebufferObject::hasOpenGLFramebufferObjects()) {
+		cerr << "Framebuffer objects not supported. "
+		     << "Showing the window." << endl;
+		offscreen = 0;
+		window()->show();
+		return;
+	}
+
+	Image& image = getActiveImage();
+	GLsizei width = offscreen_width, height = offscreen_height;
+	if (!width || !height) {
+		width = image.width();
+		height = image.height();
+	}
+	if (!width || !height)
+		return;
+
+	if (!fbo || (fbo->width() != width) || (fbo->height() != height)) {
+		delete fbo;
+		fbo = new QGLFramebufferObject(width, height);
+	}
+	fbo->bind();
+	if (!offscreen_init) {
+		initializeGL();
+		offscreen_init = 1;
+	}
+	if ((width != w_width) || (height != w_height))
+		resizeGL(width, height);
+	paintGL();
+	readRenderedFrame();
+	fbo->release();
+}
+
+// the image is scaled, colormapped and sent with XPutImage, at the
+// same place and zoom as calcResize. No GL call is made
+void ImageWidget::drawSoftware()
+{
+	Display *display = QX11Info::display();
+	w_width = width();
+	w_height = height();
+	Image& image = getActiveImage();
+	if (!w_width || !w_height || !image.isValid())
+		return;
+
+	normalize(must_normalize);
+	must_normalize = 0;
+	must_convert = must_compare = must_upload = 0;
+
+	GLfloat xfactor = float(w_width) / image.width();
+	GLfloat yfactor = float(w_height) / image.height();
+	factor = min(xfactor, yfactor);
+	int dst_width = max(1, int(image.width() * factor));
+	int dst_height = max(1, int(image.height() * factor));
+	if (!allocSoftImage(dst_width, dst_height))
+		return;
+
+	if (!soft_gc)
+		soft_gc = XCreateGC(display, winId(), 0, NULL);
+	int dst_x = (w_width - dst_width) / 2;
+	int dst_y = (w_height - dst_height) / 2;
+	if ((dst_x != soft_x) || (dst_y != soft_y)) {
+		XSetForeground(display, soft_gc, 0);
+		XFillRectangle(display, winId(), soft_gc, 0, 0, w_width, 
+			       w_height);
+		soft_x = dst_x;
+		soft_y = dst_y;
+	}
+
+	image.colormap(min_val, max_val, soft_lut, 
+		       (unsigned int *) soft_image->data, dst_width, 
+		       dst_height, soft_image->bytes_per_line / 4);
+	if (soft_shminfo.shmaddr) {
+		// XSync: the next frame must not overwrite the segment 
+		// before the server has read it
+		XShmPutImage(display, winId(), soft_gc, soft_image, 0, 0, 
+			     dst_x, dst_y, dst_width, dst_height, False);
+		XSync(display, False);
+	} else {
+		XPutImage(display, winId(), soft_gc, soft_image, 0, 0, 
+			  dst_x, dst_y, dst_width, dst_height);
+		XFlush(display);
+	}
+	upload_bytes += (unsigned long long) soft_image->bytes_per_line * 
+			dst_height;
+}
+
+// 32-bit pixels in the window visual, kept while the size is the same
+bool ImageWidget::allocSoftImage(int width, int height)
+{
+	if (soft_image && (soft_image->width == width) && 
+	    (soft_image->height == height))
+		return true;
+
+	freeSoftImage();
+
+	Display *display = QX11Info::display();
+	XWindowAttributes wa;
+	if (XGetWindowAttributes(display, winId(), &wa) == 0)
+		return false;
+	if (wa.visual->c_class < TrueColor) {
+		cerr << "Software render mode needs a 24-bit TrueColor "
+		     << "visual" << endl;
+		return false;
+	}
+
+	if (!soft_use_shm || 
+	    !createShmImage(wa.visual, wa.depth, width, height)) {
+		char *data = (char *) malloc(width * height * 4);
+		if (!data)
+			throw exception();
+		soft_image = XCreateImage(display, wa.visual, wa.depth, 
+					  ZPixmap, 0, data, width, height, 
+					  32, 0);
+		if (!soft_image)
+			free(data);
+	}
+	if (!soft_image || (soft_image->bits_per_pixel != 32)) {
+		cerr << "Software render mode needs a 24-bit TrueColor "
+		     << "visual" << endl;
+		freeSoftImage();
+		return false;
+	}
+
+	// pixels are written in host order, Xlib swaps them if needed
+	int one = 1;
+	soft_image->byte_order = *(char *) &one ? LSBFirst : MSBFirst;
+	soft_x = soft_y = -1;
+
+	// the lut depends on the window visual
+	setColormap(colormap);
+	return true;
+}
+
+static bool shm_attach_failed;
+
+static int shmAttachErrorHandler(Display *, XErrorEvent *)
+{
+	shm_attach_failed = true;
+	return 0;
+}
+
+// MIT-SHM image, only for a local server. On failure XShmPutImage is 
+// not tried again and the pixels go through the X connection
+bool ImageWidget::createShmImage(Visual *visual, int depth, int width,
+				 int height)
+{
+	Display *display = QX11Info::display();
+	QString name = DisplayString(display);
+	if ((!name.startsWith(":") && !name.startsWith("unix:")) ||
+	    !XShmQueryExtension(display)) {
+		soft_use_shm = 0;
+		return false;
+	}
+
+	soft_image = XShmCreateImage(display, visual, depth, ZPixmap, NULL,
+				     &soft_shminfo, width, height);
+	if (!soft_image)
+		return false;
+	soft_shminfo.shmid = shmget(IPC_PRIVATE, soft_image->bytes_per_line *
+				    soft_image->height, IPC_CREAT | 0600);
+	if (soft_shminfo.shmid < 0) {
+		XDestroyImage(soft_image);
+		soft_image = NULL;
+		return false;
+	}
+	soft_shminfo.shmaddr = (char *) shmat(soft_shminfo.shmid, NULL, 0);
+	if (soft_shminfo.shmaddr == (char *) -1) {
+		shmctl(soft_shminfo.shmid, IPC_RMID, NULL);
+		soft_shminfo.shmaddr = NULL;
+		XDestroyImage(soft_image);
+		soft_image = NULL;
+		return false;
+	}
+	soft_image->data = soft_shminfo.shmaddr;
+	soft_shminfo.readOnly = True;
+
+	XSync(display, False);
+	shm_attach_failed = false;
+	XErrorHandler prev_handler = XSetErrorHandler(shmAttachErrorHandler);
+	XShmAttach(display, &soft_shminfo);
+	XSync(display, False);
+	XSetErrorHandler(prev_handler);
+	// the segment is freed when both sides have detached
+	shmctl(soft_shminfo.shmid, IPC_RMID, NULL);
+	if (shm_attach_failed) {
+		cerr << "MIT-SHM attach failed, using XPutImage" << endl;
+		soft_use_shm = 0;
+		shmdt(soft_shminfo.shmaddr);
+		soft_shminfo.shmaddr = NULL;
+		soft_image->data = NULL;
+		XDestroyImage(soft_image);
+		soft_image = NULL;
+		return false;
+	}
+	return true;
+}
+
+void ImageWidget::freeSoftImage()
+{
+	if (!soft_image)
+		return;
+
+	if (soft_shminfo.shmaddr) {
+		Display *display = QX11Info::display();
+		XShmDetach(display, &soft_shminfo);
+		XSync(display, False);
+		soft_image->data = NULL;
+		XDestroyImage(soft_image);
+		shmdt(soft_shminfo.shmaddr);
+		soft_shminfo.shmaddr = NULL;
+	} else {
+		XDestroyImage(soft_image);	// frees the data
+	}
+	soft_image = NULL;
+}
+
+static unsigned int maskColor(float val, unsigned long mask)
+{
+	if (!mask)
+		return 0;
+	int shift = 0;
+	for (; !(mask & 1); mask >>= 1)
+		++shift;
+	return (unsigned int) (val * mask + 0.5) << shift;
+}
+
+void ImageWidget::setSoftwareColormap(float map[][4], int size)
+{
+	XWindowAttributes wa;
+	if (XGetWindowAttributes(QX11Info::display(), winId(), &wa) == 0)
+		return;
+
+	Visual *visual = wa.visual;
+	for (int i = 0; (i < size) && (i < ImageLutSize); ++i)
+		soft_lut[i] = (maskColor(map[i][0], visual->red_mask) |
+			       maskColor(map[i][1], visual->green_mask) |
+			       maskColor(map[i][2], visual->blue_mask));
+}
+
+// the frame is reduced to the drawn size and colormapped here: only
+// 1 (color index) or 3 (RGB) bytes per window pixel go to the X server
+void ImageWidget::drawRemote(Image& image)
+{
+	must_convert = must_compare = must_upload = 0;
+
+	int dst_width = max(1, int(image.width() * factor));
+	int dst_height = max(1, int(image.height() * factor));
+	long nr_pixels = long(dst_width) * dst_height;
+	remote_buffer.resize(nr_pixels);
+	image.colormap(min_val, max_val, soft_lut, &remote_buffer[0], 
+		       dst_width, dst_height, dst_width);
+
+	int pixel_bytes = (remote_format == GL_RGB) ? 3 : 1;
+	remote_pixels.resize(nr_pixels * pixel_bytes);
+	unsigned char *p = &remote_pixels[0];
+	for (long i = 0; i < nr_pixels; ++i) {
+		unsigned int val = remote_buffer[i];
+		for (int j = 0; j < pixel_bytes; ++j, val >>= 8)
+			*p++ = (unsigned char) val;
+	}
+
+	// already at the window scale
+	glPixelZoom(1, -1);
+	glDrawPixels(dst_width, dst_height, remote_format, GL_UNSIGNED_BYTE,
+		     &remote_pixels[0]);
+	glPixelZoom(factor, -factor);
+
+	upload_bytes += remote_pixels.size();
+	if (Image::debug)
+		cout << "drawRemote: " << dst_width << "x" << dst_height
+		     << ", " << remote_pixels.size() << " bytes" << endl;
+}
+
+// the index is expanded by the GL pixel map on the server side,
+// RGB is looked up here: lut holds R, G and B in its low bytes
+void ImageWidget::setRemoteColormap(float map[][4], int size)
+{
+	if (remote_format == GL_COLOR_INDEX)
+		setPixelMapColormap(map, size);
+
+	for (int i = 0; (i < size) && (i < ImageLutSize); ++i) {
+		if (remote_format == GL_COLOR_INDEX) {
+			soft_lut[i] = i;
+			continue;
+		}
+		soft_lut[i] = 0;
+		for (int j = 0; j < 3; ++j)
+			soft_lut[i] |= (unsigned int) (map[i][j] * 255 + 0.5)
+				       << (j * 8);
+	}
+}
+
+// RGBA, first row on top
+void ImageWidget::readRenderedFrame()
+{
+	if ((rendered_width != w_width) || (rendered_height != w_height)) {
+		free(rendered_frame);
+		rendered_frame = (unsigned char *) malloc(w_width * w_height *
+							  4);
+		if (!rendered_frame)
+			throw exception();
+		rendered_width = w_width;
+		rendered_height = w_height;
+	}
+
+	// the normalisation pixel transfer must not apply here
+	glPushAttrib(GL_PIXEL_MODE_BIT);
+	glPixelTransferf(GL_RED_SCALE,   1);
+	glPixelTransferf(GL_RED_BIAS,    0);
+	glPixelTransferf(GL_GREEN_SCALE, 1);
+	glPixelTransferf(GL_GREEN_BIAS,  0);
+	glPixelTransferf(GL_BLUE_SCALE,  1);
+	glPixelTransferf(GL_BLUE_BIAS,   0);
+	glDisable(GL_COLOR_TABLE);
+	glReadPixels(0, 0, rendered_width, rendered_height, GL_RGBA, 
+		     GL_UNSIGNED_BYTE, rendered_frame);
+	glPopAttrib();
+
+	int row_size = rendered_width * 4;
+	unsigned char row[row_size];
+	for (int i = 0, j = rendered_height - 1; i < j; ++i, --j) {
+		unsigned char *top = rendered_frame + i * row_size;
+		unsigned char *bottom = rendered_frame + j * row_size;
+		memcpy(row, top, row_size);
+		memcpy(top, bottom, row_size);
+		memcpy(bottom, row, row_size);
+	}
+}
+
+// copy of the last frame drawn offscreen. Returns false if there is 
+// none of width x height
+bool ImageWidget::getRenderedFrame(void *rgba, int width, int height)
+{
+	if (!rendered_frame || (width != rendered_width) || 
+	    (height != rendered_height))
+		return false;
+	memcpy(rgba, rendered_frame, width * height * 4);
+	return true;
+}
+
 
 /********************************************************************
  * ImageWindow
@@ -640,14 +2055,26 @@ ImageWindow::ImageWindow(QString caption)
 	: QMainWindow()
 {
 	relaxed = false;
+	pending_update = false;
 	calc_rate = 1.0;
 	update_rate.setUpdateRate(&calc_rate);
 	refresh_rate.setUpdateRate(&calc_rate);
 	max_refresh_rate = NULL;
-	if (DefaultMaxRefreshRate > 0)
-		max_refresh_rate = new Rate(DefaultMaxRefreshRate);
-
-	buffer_event = NULL;
+	// IMAGE_MAX_REFRESH_RATE caps the frames per second, 0 is no cap
+	float max_rate = DefaultMaxRefreshRate;
+	QString env = getenv("IMAGE_MAX_REFRESH_RATE");
+	if (!env.isEmpty())
+		max_rate = env.toFloat();
+	if (max_rate > 0)
+		max_refresh_rate = new Rate(max_rate);
+
+	frame_nb = disp_frame_nb = -1;
+	explicit_frame_nb = false;
+	disp_frames = skip_frames = acq_frames = 0;
+
+	nr_wakeups = 0;
+	nr_intervals = 0;
+	interval_sum = interval_sum2 = 0;
 
 	close_cb = NULL;
 	close_cb_data = NULL;
@@ -661,52 +2088,175 @@ ImageWindow::ImageWindow(QString caption)
 	image = new ImageWidget();
 	setCentralWidget(image);
 
+	// IMAGE_OFFSCREEN=1 draws at the image size, =<width>x<height> at 
+	// a fixed size. The window is not shown, the refresh is the same
+	env = getenv("IMAGE_OFFSCREEN");
+	int width = 0, height = 0;
+	bool offscreen = ((env == "1") || (env == "Yes") ||
+			  (sscanf(env.toAscii().constData(), "%dx%d", 
+				  &width, &height) == 2));
+	if (offscreen)
+		image->setOffscreen(width, height);
+
 	startTimer(0);
-	show();
+	if (!offscreen)
+		show();
 }
 
 ImageWindow::~ImageWindow()
 {
-	if (buffer_event != NULL)
-		delete buffer_event;
 	if (max_refresh_rate != NULL)
 		delete max_refresh_rate;
 }
 
-int ImageWindow::setBuffer(void *buffer, int width, int height, int depth)
+// publish and update at once. The handed back buffers are forgotten:
+// the caller must keep each buffer valid until the next one has been
+// displayed. Use publishBuffer/reclaimBuffer to know when it is free
+int ImageWindow::setBuffer(void *buffer, int width, int height, int depth,
+			   ImagePixelPtr::Type type)
 { 
-	SetBufferEvent *event;
-	event = new SetBufferEvent(buffer, width, height, depth);
+	publishBuffer(buffer, width, height, depth, type);
+	void *released;
+	while (frame_ring.reclaim(released))
+		;
+	update(false);
+	return 0;
+}
 
-	Lock lock(buffer_mutex);
+// without lock, from a single producer thread. The buffer replaces the
+// one not taken yet, and belongs to the window until handed back by 
+// reclaimBuffer. It is shown on the next update, which the caller must
+// request
+void ImageWindow::publishBuffer(void *buffer, int width, int height, 
+				int depth, ImagePixelPtr::Type type)
+{
+	frame_ring.publish(BufferData(buffer, width, height, depth, type));
+}
 
-	if (buffer_event != NULL)
-		delete buffer_event;
-	buffer_event = event;
+bool ImageWindow::reclaimBuffer(void *& buffer)
+{
+	return frame_ring.reclaim(buffer);
+}
 
-	update(false);
+// the frame sequence number travels with the next update
+void ImageWindow::setFrameNb(long new_frame_nb)
+{
+	Lock lock(buffer_mutex);
+	if (!explicit_frame_nb) {
+		// forget the implicit sequence
+		frame_nb = disp_frame_nb = -1;
+		disp_frames = skip_frames = acq_frames = 0;
+		explicit_frame_nb = true;
+	}
+	newFrame(new_frame_nb);
+}
 
-	return 0;
+// buffer_mutex must be locked
+void ImageWindow::newFrame(long new_frame_nb)
+{
+	if (new_frame_nb == frame_nb)
+		return;
+	// a sequence restart counts as a single new frame
+	bool in_seq = (frame_nb >= 0) && (new_frame_nb > frame_nb);
+	acq_frames += in_seq ? (new_frame_nb - frame_nb) : 1;
+	frame_nb = new_frame_nb;
 }
 
-SetBufferEvent *ImageWindow::checkBufferEvent()
+// called in the main thread after each real update
+void ImageWindow::frameDisplayed()
 {
 	Lock lock(buffer_mutex);
+	if ((frame_nb < 0) || (frame_nb == disp_frame_nb))
+		return;
+	bool in_seq = (disp_frame_nb >= 0) && (frame_nb > disp_frame_nb);
+	if (in_seq)
+		skip_frames += frame_nb - disp_frame_nb - 1;
+	++disp_frames;
+	disp_frame_nb = frame_nb;
+}
 
-	SetBufferEvent *event = buffer_event;
-	buffer_event = NULL;
-	
-	return event;
+void ImageWindow::getFrameStats(unsigned long *displayed, 
+				unsigned long *skipped, 
+				unsigned long *acquired)
+{
+	Lock lock(buffer_mutex);
+	if (displayed)
+		*displayed = disp_frames;
+	if (skipped)
+		*skipped = skip_frames;
+	if (acquired)
+		*acquired = acq_frames;
+}
+
+void ImageWindow::getUploadStats(unsigned long long *uploaded,
+				 unsigned long long *saved)
+{
+	image->getUploadStats(uploaded, saved);
+}
+
+// wakeups of the window since its creation; the mean interval between
+// displayed frames and its standard deviation (jitter), in seconds,
+// since the previous call
+void ImageWindow::getPacingStats(unsigned long *wakeups, float *interval,
+				 float *jitter)
+{
+	Lock lock(buffer_mutex);
+	double mean = 0, var = 0;
+	if (nr_intervals) {
+		mean = interval_sum / nr_intervals;
+		var = max(interval_sum2 / nr_intervals - mean * mean, 0.0);
+	}
+	if (wakeups)
+		*wakeups = nr_wakeups;
+	if (interval)
+		*interval = float(mean);
+	if (jitter)
+		*jitter = float(sqrt(var));
+	nr_intervals = 0;
+	interval_sum = interval_sum2 = 0;
 }
 
 void ImageWindow::update(bool just_update)
 {
+	if (!just_update) {
+		Lock lock(buffer_mutex);
+		// without explicit numbering each update is a new frame
+		if (!explicit_frame_nb)
+			newFrame(frame_nb + 1);
+	}
+
 	update_rate.update();
-	if (relaxed && !just_update) {
-		UpdateEvent *event = new UpdateEvent();
-		QApplication::postEvent(this, event);
+	if (just_update)
+		return;
+
+	// during the refresh period the update waits for its end
+	bool post;
+	{
+		Lock lock(buffer_mutex);
+		post = relaxed;
+		if (!post)
+			pending_update = true;
 		relaxed = false;
 	}
+	if (post)
+		postUpdate();
+}
+
+void ImageWindow::postUpdate()
+{
+	UpdateEvent *event = new UpdateEvent();
+	QApplication::postEvent(this, event);
+}
+
+// time before the window needs the event loop, -1 if nothing is pending.
+// At the end of the refresh period a pending update is posted
+float ImageWindow::pendingTime()
+{
+	if (relaxed)
+		return -1;
+	if (!max_refresh_rate)
+		return 0;
+	return max(max_refresh_rate->remainingTime(), float(0));
 }
 
 void ImageWindow::closeEvent(QCloseEvent *event)
@@ -727,7 +2277,7 @@ void ImageWindow::setCloseCB(closeCB cb, void *cb_data)
 void ImageWindow::setColormap(ImageWidget::ColormapType colormap)
 {
 	image->setColormap(colormap);
-	image->update();
+	image->requestUpdate();
 }
 	
 void ImageWindow::getRates(float *update, float *refresh)
@@ -738,18 +2288,26 @@ void ImageWindow::getRates(float *update, float *refresh)
 		*refresh = refresh_rate.get();
 }
 
-void ImageWindow::getNorm(unsigned long *minval, unsigned long *maxval, 
-			  int *autorange)
+void ImageWindow::getNorm(double *minval, double *maxval, int *autorange)
 {
 	image->getNorm(minval, maxval, autorange);
 }
 
-void ImageWindow::setNorm(unsigned long minval, unsigned long maxval, 
-			  int autorange)
+void ImageWindow::setNorm(double minval, double maxval, int autorange)
 {
 	image->setNorm(minval, maxval, autorange);
 }
 
+void ImageWindow::getViewSize(int *width, int *height)
+{
+	image->getViewSize(width, height);
+}
+
+bool ImageWindow::getRenderedFrame(void *rgba, int width, int height)
+{
+	return image->getRenderedFrame(rgba, width, height);
+}
+
 int ImageWindow::startTimer(int msec)
 {
 	timer_id = QMainWindow::startTimer(msec);
@@ -759,29 +2317,58 @@ int ImageWindow::startTimer(int msec)
 void ImageWindow::timerEvent(QTimerEvent *UNUSED(event))
 {
 	killTimer(timer_id);
+	{
+		Lock lock(buffer_mutex);
+		++nr_wakeups;
+	}
+	scheduleRefresh();
+}
+
+// the next update is accepted when the refresh period is over. Until
+// then the timer sleeps for the whole time left: a new frame wakes 
+// the window only through its UpdateEvent, the last one arrived during
+// the period is posted when it ends
+void ImageWindow::scheduleRefresh()
+{
 	if (!max_refresh_rate || max_refresh_rate->isTime()) {
-		relaxed = true;
+		bool pending;
+		{
+			Lock lock(buffer_mutex);
+			pending = pending_update;
+			pending_update = false;
+			relaxed = !pending;
+		}
+		if (pending)
+			postUpdate();
 		return;
 	}
 
-	float msec = min(max_refresh_rate->remainingTime() * 1e3, 1.0);
-	startTimer(int(msec));
+	float msec = max_refresh_rate->remainingTime() * 1e3;
+	startTimer(int(ceil(msec)));
 }
 
 void ImageWindow::customEvent(QEvent *event)
 { 
-	SetBufferEvent *bevent = checkBufferEvent();
-	if (bevent != NULL) {
-		SetBufferEvent::BufferData* buff_data = bevent->bufferData();
-		realSetBuffer(buff_data->buffer, buff_data->width, 
-			      buff_data->height, buff_data->depth);
-		delete bevent;
+	// the newest frame is taken now
+	if (event->type() == ImageEvent::Update) {
+		Lock lock(buffer_mutex);
+		pending_update = false;
 	}
 
+	BufferData buff_data;
+	if (frame_ring.takeNewest(buff_data))
+		realSetBuffer(buff_data.buffer, buff_data.width, 
+			      buff_data.height, buff_data.depth, 
+			      buff_data.type);
+
 	switch (event->type()) {
 	case ImageEvent::Update:
+		{
+			Lock lock(buffer_mutex);
+			++nr_wakeups;
+		}
 		realUpdate();
-		startTimer(0);
+		scheduleRefresh();
 		break;
 	default:
 		break;
@@ -792,12 +2379,23 @@ void ImageWindow::realUpdate()
 { 
 	image->updateImage();
 	refresh_rate.update();
+	frameDisplayed();
+
+	Lock lock(buffer_mutex);
+	if (last_display.isValid()) {
+		double interval = last_display.timeElapsed(PrecTime::Reset);
+		interval_sum += interval;
+		interval_sum2 += interval * interval;
+		++nr_intervals;
+	} else {
+		last_display.setNow();
+	}
 }
 
 int ImageWindow::realSetBuffer(void *buffer, int width, int height, 
-			       int depth)
+			       int depth, ImagePixelPtr::Type type)
 {
-	return image->setBuffer(buffer, width, height, depth, false); 
+	return image->setBuffer(buffer, width, height, depth, type, false); 
 }
 
 
@@ -896,6 +2494,31 @@ int ImageApplication::poll()
 	return 0;
 }
 
+int ImageApplication::xConnectionFd()
+{
+	return ConnectionNumber(display);
+}
+
+float ImageApplication::eventTimeout(float timeout)
+{
+	// X events may already be queued by Xlib, not seen by select
+	if (hasPendingEvents() || XPending(display))
+		return 0;
+
+	QWidgetList list = topLevelWidgets();
+	for (int i = 0; i < list.size(); i++) {
+		ImageWindow *win = qobject_cast<ImageWindow *>(list[i]);
+		if (!win)
+			continue;
+		float win_timeout = win->pendingTime();
+		if ((win_timeout >= 0) && 
+		    ((timeout < 0) || (win_timeout < timeout)))
+			timeout = win_timeout;
+	}
+
+	return timeout;
+}
+
 ImageWindow *ImageApplication::createImage(QString caption)
 {
 	ImageWindow *win;
@@ -910,9 +2533,10 @@ ImageWindow *ImageApplication::createImage(QString caption)
 }
 
 int ImageApplication::setImageBuffer(ImageWindow *win, void *buffer,
-				     int width, int height, int depth)
+				     int width, int height, int depth,
+				     ImagePixelPtr::Type type)
 {
-	win->setBuffer(buffer, width, height, depth);
+	win->setBuffer(buffer, width, height, depth, type);
 	return 0;
 }
 
@@ -940,14 +2564,36 @@ void ImageApplication::getImageRates(ImageWindow *win,
 	win->getRates(update, refresh);
 }
 
-void ImageApplication::getImageNorm(ImageWindow *win, unsigned long *minval, 
-				    unsigned long *maxval, int *autorange)
+void ImageApplication::getImageFrameStats(ImageWindow *win, 
+					  unsigned long *displayed,
+					  unsigned long *skipped,
+					  unsigned long *acquired)
+{
+	win->getFrameStats(displayed, skipped, acquired);
+}
+
+void ImageApplication::getImageUploadStats(ImageWindow *win, 
+					   unsigned long long *uploaded,
+					   unsigned long long *saved)
+{
+	win->getUploadStats(uploaded, saved);
+}
+
+void ImageApplication::getImagePacingStats(ImageWindow *win, 
+					   unsigned long *wakeups,
+					   float *interval, float *jitter)
+{
+	win->getPacingStats(wakeups, interval, jitter);
+}
+
+void ImageApplication::getImageNorm(ImageWindow *win, double *minval, 
+				    double *maxval, int *autorange)
 {
 	win->getNorm(minval, maxval, autorange);
 }
 
-void ImageApplication::setImageNorm(ImageWindow *win, unsigned long minval, 
-				    unsigned long maxval, int autorange)
+void ImageApplication::setImageNorm(ImageWindow *win, double minval, 
+				    double maxval, int autorange)
 {
 	win->setNorm(minval, maxval, autorange);
 }
@@ -998,6 +2644,9 @@ ImageLib::ImageLib(int argc, char **argv)
 	char *str = getenv("IMAGE_DEBUG");
 	if (str)
 		Image::debug = atoi(str);
+	str = getenv("IMAGE_THREADS");
+	if (str)
+		imageSetThreads(atoi(str));
 
 	app = NULL;
 	main_thread = pthread_self();
@@ -1070,6 +2719,44 @@ int ImageLib::poll()
 	return app->poll();
 }
 
+// Block until fd is readable, X events arrive or timeout expires 
+// (no timeout if negative). Returns 1 if fd is readable. Out of the
+// main thread the X events are not processed there: only fd is waited
+int ImageLib::waitEvents(int fd, float timeout)
+{
+	int xfd = -1;
+	if (inMainThread()) {
+		Lock lock = getLock();
+		if (appCreated()) {
+			timeout = app->eventTimeout(timeout);
+			xfd = app->xConnectionFd();
+		}
+	}
+	// nothing could end an endless wait
+	if ((fd < 0) && (xfd < 0) && (timeout < 0))
+		return 0;
+
+	fd_set read_fds;
+	FD_ZERO(&read_fds);
+	if (fd >= 0)
+		FD_SET(fd, &read_fds);
+	if (xfd >= 0)
+		FD_SET(xfd, &read_fds);
+
+	struct timeval tv, *tv_ptr = NULL;
+	if (timeout >= 0) {
+		tv.tv_sec = int(timeout);
+		tv.tv_usec = int((timeout - tv.tv_sec) * 1e6);
+		tv_ptr = &tv;
+	}
+
+	int ret = select(max(fd, xfd) + 1, &read_fds, NULL, NULL, tv_ptr);
+	if (ret <= 0)
+		return 0;
+
+	return ((fd >= 0) && FD_ISSET(fd, &read_fds)) ? 1 : 0;
+}
+
 void ImageLib::checkApplication()
 {
 	{
@@ -1132,9 +2819,10 @@ void ImageLib::destroyImage(ImageWindow *win)
 }
 
 int ImageLib::setImageBuffer(ImageWindow *win, void *buffer,
-			     int width, int height, int depth)
+			     int width, int height, int depth,
+			     ImagePixelPtr::Type type)
 {
-	app->setImageBuffer(win, buffer, width, height, depth);
+	app->setImageBuffer(win, buffer, width, height, depth, type);
 	return 0;
 }
 
@@ -1163,15 +2851,43 @@ void ImageLib::getImageRates(ImageWindow *win, float *update, float *refresh)
 	app->getImageRates(win, update, refresh);
 }
 
-void ImageLib::getImageNorm(ImageWindow *win, unsigned long *minval, 
-			    unsigned long *maxval, int *autorange)
+void ImageLib::setImageFrameNb(ImageWindow *win, long frame_nb)
+{
+	win->setFrameNb(frame_nb);
+}
+
+void ImageLib::getImageFrameStats(ImageWindow *win, unsigned long *displayed,
+				  unsigned long *skipped, 
+				  unsigned long *acquired)
+{
+	Lock lock = getLock();
+	app->getImageFrameStats(win, displayed, skipped, acquired);
+}
+
+void ImageLib::getImageUploadStats(ImageWindow *win, 
+				   unsigned long long *uploaded,
+				   unsigned long long *saved)
+{
+	Lock lock = getLock();
+	app->getImageUploadStats(win, uploaded, saved);
+}
+
+void ImageLib::getImagePacingStats(ImageWindow *win, unsigned long *wakeups,
+				   float *interval, float *jitter)
+{
+	Lock lock = getLock();
+	app->getImagePacingStats(win, wakeups, interval, jitter);
+}
+
+void ImageLib::getImageNorm(ImageWindow *win, double *minval, 
+			    double *maxval, int *autorange)
 {
 	Lock lock = getLock();
 	app->getImageNorm(win, minval, maxval, autorange);
 }
 
-void ImageLib::setImageNorm(ImageWindow *win, unsigned long minval, 
-			    unsigned long maxval, int autorange)
+void ImageLib::setImageNorm(ImageWindow *win, double minval, 
+			    double maxval, int autorange)
 {
 	if (inMainThread()) {
 		Lock lock = getLock();
@@ -1268,14 +2984,39 @@ void image_get_rates(image_t img, float *update, float *refresh)
 	img_lib->getImageRates(imageWindow(img), update, refresh);
 }
 
-void image_get_norm(image_t img, unsigned long *min_val, 
-		    unsigned long *max_val, int *auto_range)
+void image_set_frame_nb(image_t img, long frame_nb)
+{
+	img_lib->setImageFrameNb(imageWindow(img), frame_nb);
+}
+
+void image_get_frame_stats(image_t img, unsigned long *displayed,
+			   unsigned long *skipped, unsigned long *acquired)
+{
+	img_lib->getImageFrameStats(imageWindow(img), displayed, skipped,
+				    acquired);
+}
+
+void image_get_upload_stats(image_t img, unsigned long long *uploaded,
+			    unsigned long long *saved)
+{
+	img_lib->getImageUploadStats(imageWindow(img), uploaded, saved);
+}
+
+void image_get_pacing_stats(image_t img, unsigned long *wakeups,
+			    float *interval, float *jitter)
+{
+	img_lib->getImagePacingStats(imageWindow(img), wakeups, interval, 
+				     jitter);
+}
+
+void image_get_norm(image_t img, double *min_val, 
+		    double *max_val, int *auto_range)
 {
 	img_lib->getImageNorm(imageWindow(img), min_val, max_val, auto_range);
 }
 
-void image_set_norm(image_t img, unsigned long min_val, 
-		    unsigned long max_val, int auto_range)
+void image_set_norm(image_t img, double min_val, 
+		    double max_val, int auto_range)
 {
 	img_lib->setImageNorm(imageWindow(img), min_val, max_val, auto_range);
 }
@@ -0,0 +1,1811 @@
+//###########################################################################
+// This file is part of gldisplay, a submodule of LImA project the
+// Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#include "imageproc.h"
+
+#include <math.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// AVX2 kernels are built for x86 with GCC/clang and selected at run time.
+// A build without SSE2 stays scalar
+#if defined(__SSE2__) && defined(__GNUC__) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define IMAGEPROC_AVX2
+#include <immintrin.h>
+#define AVX2_TARGET __attribute__((target("avx2")))
+#endif
+
+
+/********************************************************************
+ * Helpers
+ ********************************************************************/
+
+static inline bool isFinite(double val)
+{
+	return fabs(val) < HUGE_VAL;	// false for NaN
+}
+
+static inline unsigned short convertPixel(double val, double min_val,
+					  double scale)
+{
+	double x = (val - min_val) * scale;
+	if (!isFinite(val) || !(x > 0))
+		return 0;
+	if (x >= ImageDisplayMax)
+		return ImageDisplayMax;
+	return (unsigned short) (x + 0.5);
+}
+
+static inline double convertScale(double min_val, double max_val)
+{
+	double range = max_val - min_val;
+	return (range > 0) ? (ImageDisplayMax / range) : 0;
+}
+
+template <class T>
+static inline T max(T a, T b)
+{
+	return (a > b) ? a : b;
+}
+
+template <class T>
+static inline T min(T a, T b)
+{
+	return (a < b) ? a : b;
+}
+
+/********************************************************************
+ * Parallel bands
+ *
+ * Large frames are split in bands of rows processed by a pool of
+ * persistent worker threads, the calling one taking bands too. The
+ * workers are started on first use and only ever wait for the next job
+ ********************************************************************/
+
+typedef void BandFunc(void *data, int first, int last);
+
+enum {
+	BandMinPixels = 1 << 19,
+	MaxBands = 16,
+};
+
+struct BandPool {
+	pthread_mutex_t run_lock;	// one job at a time
+	pthread_mutex_t lock;		// protects the job state
+	pthread_cond_t start, done;
+	int nr_workers;
+	unsigned long job;
+	BandFunc *func;
+	void *data;
+	int nr_rows, nr_bands;
+	int next_band, nr_done;
+};
+
+static BandPool pool = {
+	PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER,
+	PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER,
+	0, 0, NULL, NULL, 0, 0, 0, 0,
+};
+
+static int max_threads = 0;
+
+// the threads are not inherited: a forked child starts a new pool
+static void poolAtFork()
+{
+	pthread_mutex_init(&pool.run_lock, NULL);
+	pthread_mutex_init(&pool.lock, NULL);
+	pthread_cond_init(&pool.start, NULL);
+	pthread_cond_init(&pool.done, NULL);
+	pool.nr_workers = 0;
+}
+
+static void poolInit()
+{
+	pthread_atfork(NULL, NULL, poolAtFork);
+}
+
+// called with pool.lock held, which is released while processing
+static void takeBands()
+{
+	while (pool.next_band < pool.nr_bands) {
+		int i = pool.next_band++;
+		BandFunc *func = pool.func;
+		void *data = pool.data;
+		int first = int((long long) pool.nr_rows * i / pool.nr_bands);
+		int last = int((long long) pool.nr_rows * (i + 1) /
+			       pool.nr_bands);
+		pthread_mutex_unlock(&pool.lock);
+		func(data, first, last);
+		pthread_mutex_lock(&pool.lock);
+		if (++pool.nr_done == pool.nr_bands)
+			pthread_cond_signal(&pool.done);
+	}
+}
+
+// arg is the last job before the worker started
+static void *bandWorker(void *arg)
+{
+	unsigned long job = (unsigned long) arg;
+	pthread_mutex_lock(&pool.lock);
+	for (;;) {
+		while (pool.job == job)
+			pthread_cond_wait(&pool.start, &pool.lock);
+		job = pool.job;
+		takeBands();
+	}
+	return NULL;
+}
+
+// with pool.lock held; if a thread cannot be started the others,
+// or the caller, process its bands
+static void startWorkers(int nr_workers)
+{
+	static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+	pthread_once(&init_once, poolInit);
+
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	for (; pool.nr_workers < nr_workers; ++pool.nr_workers) {
+		pthread_t thread;
+		if (pthread_create(&thread, &attr, bandWorker,
+				   (void *) pool.job) != 0)
+			break;
+	}
+	pthread_attr_destroy(&attr);
+}
+
+static int nrCpus()
+{
+	static int nr_cpus = 0;
+	if (nr_cpus == 0)
+		nr_cpus = max(1, int(sysconf(_SC_NPROCESSORS_ONLN)));
+	return nr_cpus;
+}
+
+// by default half of the CPUs are left to the acquisition
+static int nrThreads()
+{
+	int nr_threads = max_threads;
+	if (nr_threads <= 0)
+		nr_threads = max(1, nrCpus() / 2);
+	return min(nr_threads, int(MaxBands));
+}
+
+int imageSetThreads(int nr_threads)
+{
+	max_threads = max(0, nr_threads);
+	return nrThreads();
+}
+
+static int nrBands(int nr_rows, unsigned long nr_pixels)
+{
+	unsigned long nr_bands = nr_pixels / BandMinPixels;
+	nr_bands = min(nr_bands, (unsigned long) nrThreads());
+	return max(1, min(int(nr_bands), nr_rows));
+}
+
+static void runBands(BandFunc *func, void *data, int nr_rows,
+		     unsigned long nr_pixels)
+{
+	int nr_bands = nrBands(nr_rows, nr_pixels);
+	// small frames, or the pool already running a job of another thread
+	if ((nr_bands == 1) || (pthread_mutex_trylock(&pool.run_lock) != 0)) {
+		for (int i = 0; i < nr_bands; ++i)
+			func(data, int((long long) nr_rows * i / nr_bands),
+			     int((long long) nr_rows * (i + 1) / nr_bands));
+		return;
+	}
+
+	pthread_mutex_lock(&pool.lock);
+	startWorkers(nr_bands - 1);
+	pool.func = func;
+	pool.data = data;
+	pool.nr_rows = nr_rows;
+	pool.nr_bands = nr_bands;
+	pool.next_band = pool.nr_done = 0;
+	++pool.job;
+	pthread_cond_broadcast(&pool.start);
+	takeBands();
+	while (pool.nr_done < nr_bands)
+		pthread_cond_wait(&pool.done, &pool.lock);
+	pthread_mutex_unlock(&pool.lock);
+	pthread_mutex_unlock(&pool.run_lock);
+}
+
+// linear buffers are split in blocks of pixels, seen as rows by runBands
+enum { BandBlockPixels = 1 << 14 };
+
+static inline int nrBlocks(unsigned long len)
+{
+	return int((len + BandBlockPixels - 1) / BandBlockPixels);
+}
+
+static inline void blockRange(unsigned long len, int first, int last,
+			      unsigned long& begin, unsigned long& end)
+{
+	begin = (unsigned long) first * BandBlockPixels;
+	end = min(len, (unsigned long) last * BandBlockPixels);
+}
+
+
+#ifdef __SSE2__
+
+// SSE2 has no 32-bit min/max: select with a signed compare
+static inline __m128i maxEpi32(__m128i a, __m128i b)
+{
+	__m128i gt = _mm_cmpgt_epi32(b, a);
+	return _mm_or_si128(_mm_and_si128(gt, b), _mm_andnot_si128(gt, a));
+}
+
+static inline __m128i minEpi32(__m128i a, __m128i b)
+{
+	__m128i gt = _mm_cmpgt_epi32(a, b);
+	return _mm_or_si128(_mm_and_si128(gt, b), _mm_andnot_si128(gt, a));
+}
+
+// pack 2 x 4 int32 in [0, 65535] into 8 uint16 (SSE2 has only signed pack)
+static inline __m128i packU16(__m128i a, __m128i b)
+{
+	const __m128i bias32 = _mm_set1_epi32(0x8000);
+	const __m128i bias16 = _mm_set1_epi16(short(0x8000));
+	a = _mm_sub_epi32(a, bias32);
+	b = _mm_sub_epi32(b, bias32);
+	return _mm_xor_si128(_mm_packs_epi32(a, b), bias16);
+}
+
+// scaled, clipped and rounded; non-finite source pixels give 0
+static inline __m128i convertPs(__m128 v, __m128 offset, __m128 scale)
+{
+	const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	const __m128 inf = _mm_set1_ps(HUGE_VALF);
+	const __m128 top = _mm_set1_ps(ImageDisplayMax);
+	const __m128 half = _mm_set1_ps(0.5);
+
+	__m128 finite = _mm_cmplt_ps(_mm_and_ps(v, abs_mask), inf);
+	__m128 x = _mm_mul_ps(_mm_sub_ps(v, offset), scale);
+	x = _mm_min_ps(_mm_max_ps(x, _mm_setzero_ps()), top);
+	x = _mm_and_ps(_mm_add_ps(x, half), finite);
+	return _mm_cvttps_epi32(x);
+}
+
+static inline __m128i convertPd(__m128d v0, __m128d v1,
+				__m128d offset, __m128d scale)
+{
+	const __m128d abs_mask =
+		_mm_castsi128_pd(_mm_set1_epi64x(0x7fffffffffffffffLL));
+	const __m128d inf = _mm_set1_pd(HUGE_VAL);
+	const __m128d top = _mm_set1_pd(ImageDisplayMax);
+	const __m128d half = _mm_set1_pd(0.5);
+
+	__m128d f0 = _mm_cmplt_pd(_mm_and_pd(v0, abs_mask), inf);
+	__m128d f1 = _mm_cmplt_pd(_mm_and_pd(v1, abs_mask), inf);
+	__m128d x0 = _mm_mul_pd(_mm_sub_pd(v0, offset), scale);
+	__m128d x1 = _mm_mul_pd(_mm_sub_pd(v1, offset), scale);
+	x0 = _mm_min_pd(_mm_max_pd(x0, _mm_setzero_pd()), top);
+	x1 = _mm_min_pd(_mm_max_pd(x1, _mm_setzero_pd()), top);
+	x0 = _mm_and_pd(_mm_add_pd(x0, half), f0);
+	x1 = _mm_and_pd(_mm_add_pd(x1, half), f1);
+	return _mm_unpacklo_epi64(_mm_cvttpd_epi32(x0),
+				  _mm_cvttpd_epi32(x1));
+}
+
+#endif
+
+
+/********************************************************************
+ * SIMD dispatch
+ ********************************************************************/
+
+static int max_simd = ImageSimdAvx2;
+
+static int cpuSimd()
+{
+	static int cpu_simd = -1;
+	if (cpu_simd < 0) {
+		cpu_simd = ImageSimdNone;
+#ifdef __SSE2__
+		cpu_simd = ImageSimdSse2;
+#endif
+#ifdef IMAGEPROC_AVX2
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2"))
+			cpu_simd = ImageSimdAvx2;
+#endif
+	}
+	return cpu_simd;
+}
+
+int imageSetSimd(int max_level)
+{
+	max_simd = max(int(ImageSimdNone), min(max_level, int(ImageSimdAvx2)));
+	return min(max_simd, cpuSimd());
+}
+
+static inline int simdLevel()
+{
+	return min(max_simd, cpuSimd());
+}
+
+
+/********************************************************************
+ * Integer kernels
+ *
+ * Signed and unsigned types share the same loop, so that the compiler
+ * generates the same code for both. The vector loops return the number
+ * of pixels they processed, the rest is done by the scalar one
+ ********************************************************************/
+
+template <class T>
+static inline void reduceLanes(const T *lo, const T *hi, int nr_lanes,
+			       T& vmin, T& vmax)
+{
+	for (int j = 0; j < nr_lanes; ++j) {
+		vmin = (lo[j] < vmin) ? lo[j] : vmin;
+		vmax = (hi[j] > vmax) ? hi[j] : vmax;
+	}
+}
+
+#ifdef __SSE2__
+
+// the lanes are biased into the types SSE2 can compare: unsigned 8-bit
+// and signed 16/32-bit
+template <class T>
+struct Sse2Ops;
+
+template <>
+struct Sse2Ops<unsigned char> {
+	static __m128i bias() { return _mm_setzero_si128(); }
+	static __m128i min(__m128i a, __m128i b) { return _mm_min_epu8(a, b); }
+	static __m128i max(__m128i a, __m128i b) { return _mm_max_epu8(a, b); }
+};
+
+template <>
+struct Sse2Ops<signed char> {
+	static __m128i bias() { return _mm_set1_epi8(char(0x80)); }
+	static __m128i min(__m128i a, __m128i b) { return _mm_min_epu8(a, b); }
+	static __m128i max(__m128i a, __m128i b) { return _mm_max_epu8(a, b); }
+};
+
+template <>
+struct Sse2Ops<unsigned short> {
+	static __m128i bias() { return _mm_set1_epi16(short(0x8000)); }
+	static __m128i min(__m128i a, __m128i b) { return _mm_min_epi16(a, b); }
+	static __m128i max(__m128i a, __m128i b) { return _mm_max_epi16(a, b); }
+};
+
+template <>
+struct Sse2Ops<short> {
+	static __m128i bias() { return _mm_setzero_si128(); }
+	static __m128i min(__m128i a, __m128i b) { return _mm_min_epi16(a, b); }
+	static __m128i max(__m128i a, __m128i b) { return _mm_max_epi16(a, b); }
+};
+
+template <>
+struct Sse2Ops<unsigned int> {
+	static __m128i bias() { return _mm_set1_epi32(int(0x80000000)); }
+	static __m128i min(__m128i a, __m128i b) { return minEpi32(a, b); }
+	static __m128i max(__m128i a, __m128i b) { return maxEpi32(a, b); }
+};
+
+template <>
+struct Sse2Ops<int> {
+	static __m128i bias() { return _mm_setzero_si128(); }
+	static __m128i min(__m128i a, __m128i b) { return minEpi32(a, b); }
+	static __m128i max(__m128i a, __m128i b) { return maxEpi32(a, b); }
+};
+
+template <class T>
+static unsigned long sse2MinMax(const T *ptr, unsigned long len,
+				T& vmin, T& vmax)
+{
+	typedef Sse2Ops<T> Ops;
+	const int nr_lanes = 16 / sizeof(T);
+	unsigned long end = len / nr_lanes * nr_lanes;
+	if (!end)
+		return 0;
+
+	const __m128i bias = Ops::bias();
+	__m128i lo = _mm_xor_si128(_mm_loadu_si128((const __m128i *) ptr),
+				   bias);
+	__m128i hi = lo;
+	for (unsigned long i = nr_lanes; i < end; i += nr_lanes) {
+		__m128i v = _mm_loadu_si128((const __m128i *) (ptr + i));
+		v = _mm_xor_si128(v, bias);
+		lo = Ops::min(lo, v);
+		hi = Ops::max(hi, v);
+	}
+
+	T lo_lanes[nr_lanes], hi_lanes[nr_lanes];
+	_mm_storeu_si128((__m128i *) lo_lanes, _mm_xor_si128(lo, bias));
+	_mm_storeu_si128((__m128i *) hi_lanes, _mm_xor_si128(hi, bias));
+	reduceLanes(lo_lanes, hi_lanes, nr_lanes, vmin, vmax);
+	return end;
+}
+
+#endif
+
+#ifdef IMAGEPROC_AVX2
+
+// AVX2 compares all the integer types natively
+template <class T>
+struct Avx2Ops;
+
+template <>
+struct Avx2Ops<unsigned char> {
+	AVX2_TARGET static __m256i min(__m256i a, __m256i b)
+	{ return _mm256_min_epu8(a, b); }
+	AVX2_TARGET static __m256i max(__m256i a, __m256i b)
+	{ return _mm256_max_epu8(a, b); }
+};
+
+template <>
+struct Avx2Ops<signed char> {
+	AVX2_TARGET static __m256i min(__m256i a, __m256i b)
+	{ return _mm256_min_epi8(a, b); }
+	AVX2_TARGET static __m256i max(__m256i a, __m256i b)
+	{ return _mm256_max_epi8(a, b); }
+};
+
+template <>
+struct Avx2Ops<unsigned short> {
+	AVX2_TARGET static __m256i min(__m256i a, __m256i b)
+	{ return _mm256_min_epu16(a, b); }
+	AVX2_TARGET static __m256i max(__m256i a, __m256i b)
+	{ return _mm256_max_epu16(a, b); }
+};
+
+template <>
+struct Avx2Ops<short> {
+	AVX2_TARGET static __m256i min(__m256i a, __m256i b)
+	{ return _mm256_min_epi16(a, b); }
+	AVX2_TARGET static __m256i max(__m256i a, __m256i b)
+	{ return _mm256_max_epi16(a, b); }
+};
+
+template <>
+struct Avx2Ops<unsigned int> {
+	AVX2_TARGET static __m256i min(__m256i a, __m256i b)
+	{ return _mm256_min_epu32(a, b); }
+	AVX2_TARGET static __m256i max(__m256i a, __m256i b)
+	{ return _mm256_max_epu32(a, b); }
+};
+
+template <>
+struct Avx2Ops<int> {
+	AVX2_TARGET static __m256i min(__m256i a, __m256i b)
+	{ return _mm256_min_epi32(a, b); }
+	AVX2_TARGET static __m256i max(__m256i a, __m256i b)
+	{ return _mm256_max_epi32(a, b); }
+};
+
+// two accumulator pairs hide the latency of the min/max instructions
+template <class T>
+AVX2_TARGET static unsigned long avx2MinMax(const T *ptr, unsigned long len,
+					    T& vmin, T& vmax)
+{
+	typedef Avx2Ops<T> Ops;
+	const int nr_lanes = 32 / sizeof(T);
+	unsigned long end = len / (2 * nr_lanes) * (2 * nr_lanes);
+	if (!end)
+		return 0;
+
+	__m256i lo0 = _mm256_loadu_si256((const __m256i *) ptr);
+	__m256i lo1 = _mm256_loadu_si256((const __m256i *) (ptr + nr_lanes));
+	__m256i hi0 = lo0, hi1 = lo1;
+	for (unsigned long i = 2 * nr_lanes; i < end; i += 2 * nr_lanes) {
+		const T *p = ptr + i;
+		__m256i v0 = _mm256_loadu_si256((const __m256i *) p);
+		__m256i v1 = _mm256_loadu_si256((const __m256i *)
+						(p + nr_lanes));
+		lo0 = Ops::min(lo0, v0);
+		hi0 = Ops::max(hi0, v0);
+		lo1 = Ops::min(lo1, v1);
+		hi1 = Ops::max(hi1, v1);
+	}
+
+	T lo_lanes[nr_lanes], hi_lanes[nr_lanes];
+	_mm256_storeu_si256((__m256i *) lo_lanes, Ops::min(lo0, lo1));
+	_mm256_storeu_si256((__m256i *) hi_lanes, Ops::max(hi0, hi1));
+	reduceLanes(lo_lanes, hi_lanes, nr_lanes, vmin, vmax);
+	return end;
+}
+
+#endif
+
+template <class T>
+static inline bool intMinMax(const T *ptr, unsigned long len,
+			     double& min_val, double& max_val)
+{
+	if (len == 0)
+		return false;
+
+	T vmin = ptr[0], vmax = ptr[0];
+	unsigned long i = 1;
+#ifdef __SSE2__
+	int simd = simdLevel();
+#ifdef IMAGEPROC_AVX2
+	if (simd >= ImageSimdAvx2)
+		i = max(i, avx2MinMax(ptr, len, vmin, vmax));
+	else
+#endif
+	if (simd >= ImageSimdSse2)
+		i = max(i, sse2MinMax(ptr, len, vmin, vmax));
+#endif
+	for (; i < len; ++i) {
+		T val = ptr[i];
+		vmin = (val < vmin) ? val : vmin;
+		vmax = (val > vmax) ? val : vmax;
+	}
+
+	min_val = vmin;
+	max_val = vmax;
+	return true;
+}
+
+
+/********************************************************************
+ * Floating point kernels
+ ********************************************************************/
+
+static bool floatMinMax(const float *ptr, unsigned long len,
+			double& min_val, double& max_val)
+{
+	float fmin = HUGE_VALF, fmax = -HUGE_VALF;
+	unsigned long i = 0;
+
+#ifdef __SSE2__
+	const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	const __m128 inf = _mm_set1_ps(HUGE_VALF);
+	__m128 vmin = _mm_set1_ps(fmin);
+	__m128 vmax = _mm_set1_ps(fmax);
+	for (; i + 4 <= len; i += 4) {
+		__m128 v = _mm_loadu_ps(ptr + i);
+		__m128 finite = _mm_cmplt_ps(_mm_and_ps(v, abs_mask), inf);
+		// masked lanes are replaced by the current accumulator
+		__m128 lo = _mm_or_ps(_mm_and_ps(finite, v),
+				      _mm_andnot_ps(finite, vmin));
+		__m128 hi = _mm_or_ps(_mm_and_ps(finite, v),
+				      _mm_andnot_ps(finite, vmax));
+		vmin = _mm_min_ps(vmin, lo);
+		vmax = _mm_max_ps(vmax, hi);
+	}
+
+	float lo[4], hi[4];
+	_mm_storeu_ps(lo, vmin);
+	_mm_storeu_ps(hi, vmax);
+	for (int j = 0; j < 4; ++j) {
+		if (lo[j] < fmin)
+			fmin = lo[j];
+		if (hi[j] > fmax)
+			fmax = hi[j];
+	}
+#endif
+
+	for (; i < len; ++i) {
+		float val = ptr[i];
+		if (!isFinite(val))
+			continue;
+		if (val < fmin)
+			fmin = val;
+		if (val > fmax)
+			fmax = val;
+	}
+
+	if (fmin > fmax)
+		return false;
+
+	min_val = fmin;
+	max_val = fmax;
+	return true;
+}
+
+static bool floatMinMax(const double *ptr, unsigned long len,
+			double& min_val, double& max_val)
+{
+	double dmin = HUGE_VAL, dmax = -HUGE_VAL;
+	unsigned long i = 0;
+
+#ifdef __SSE2__
+	const __m128d abs_mask =
+		_mm_castsi128_pd(_mm_set1_epi64x(0x7fffffffffffffffLL));
+	const __m128d inf = _mm_set1_pd(HUGE_VAL);
+	__m128d vmin = _mm_set1_pd(dmin);
+	__m128d vmax = _mm_set1_pd(dmax);
+	for (; i + 2 <= len; i += 2) {
+		__m128d v = _mm_loadu_pd(ptr + i);
+		__m128d finite = _mm_cmplt_pd(_mm_and_pd(v, abs_mask), inf);
+		__m128d lo = _mm_or_pd(_mm_and_pd(finite, v),
+				       _mm_andnot_pd(finite, vmin));
+		__m128d hi = _mm_or_pd(_mm_and_pd(finite, v),
+				       _mm_andnot_pd(finite, vmax));
+		vmin = _mm_min_pd(vmin, lo);
+		vmax = _mm_max_pd(vmax, hi);
+	}
+
+	double lo[2], hi[2];
+	_mm_storeu_pd(lo, vmin);
+	_mm_storeu_pd(hi, vmax);
+	for (int j = 0; j < 2; ++j) {
+		if (lo[j] < dmin)
+			dmin = lo[j];
+		if (hi[j] > dmax)
+			dmax = hi[j];
+	}
+#endif
+
+	for (; i < len; ++i) {
+		double val = ptr[i];
+		if (!isFinite(val))
+			continue;
+		if (val < dmin)
+			dmin = val;
+		if (val > dmax)
+			dmax = val;
+	}
+
+	if (dmin > dmax)
+		return false;
+
+	min_val = dmin;
+	max_val = dmax;
+	return true;
+}
+
+static void convertRange(const float *src, unsigned long len,
+			 double min_val, double max_val, unsigned short *dst)
+{
+	double scale = convertScale(min_val, max_val);
+	unsigned long i = 0;
+
+#ifdef __SSE2__
+	__m128 voffset = _mm_set1_ps(min_val);
+	__m128 vscale = _mm_set1_ps(scale);
+	for (; i + 8 <= len; i += 8) {
+		__m128i a = convertPs(_mm_loadu_ps(src + i), voffset, vscale);
+		__m128i b = convertPs(_mm_loadu_ps(src + i + 4), voffset,
+				      vscale);
+		_mm_storeu_si128((__m128i *) (dst + i), packU16(a, b));
+	}
+#endif
+
+	for (; i < len; ++i)
+		dst[i] = convertPixel(src[i], min_val, scale);
+}
+
+static void convertRange(const double *src, unsigned long len,
+			 double min_val, double max_val, unsigned short *dst)
+{
+	double scale = convertScale(min_val, max_val);
+	unsigned long i = 0;
+
+#ifdef __SSE2__
+	__m128d voffset = _mm_set1_pd(min_val);
+	__m128d vscale = _mm_set1_pd(scale);
+	for (; i + 8 <= len; i += 8) {
+		const double *p = src + i;
+		__m128i a = convertPd(_mm_loadu_pd(p), _mm_loadu_pd(p + 2),
+				      voffset, vscale);
+		__m128i b = convertPd(_mm_loadu_pd(p + 4), _mm_loadu_pd(p + 6),
+				      voffset, vscale);
+		_mm_storeu_si128((__m128i *) (dst + i), packU16(a, b));
+	}
+#endif
+
+	for (; i < len; ++i)
+		dst[i] = convertPixel(src[i], min_val, scale);
+}
+
+
+/********************************************************************
+ * Banded statistics and conversion
+ *
+ * Each band gives its own min/max, merged under a lock
+ ********************************************************************/
+
+template <class T>
+static inline bool minMaxKernel(const T *ptr, unsigned long len,
+				double& min_val, double& max_val)
+{
+	return intMinMax(ptr, len, min_val, max_val);
+}
+
+static inline bool minMaxKernel(const float *ptr, unsigned long len,
+				double& min_val, double& max_val)
+{
+	return floatMinMax(ptr, len, min_val, max_val);
+}
+
+static inline bool minMaxKernel(const double *ptr, unsigned long len,
+				double& min_val, double& max_val)
+{
+	return floatMinMax(ptr, len, min_val, max_val);
+}
+
+struct MinMaxData {
+	const void *ptr;
+	unsigned long len;
+	pthread_mutex_t lock;
+	bool found;
+	double min_val, max_val;
+};
+
+template <class T>
+static void minMaxBlocks(void *data, int first, int last)
+{
+	MinMaxData *d = (MinMaxData *) data;
+	unsigned long begin, end;
+	blockRange(d->len, first, last, begin, end);
+
+	double min_val, max_val;
+	if (!minMaxKernel((const T *) d->ptr + begin, end - begin,
+			  min_val, max_val))
+		return;
+
+	pthread_mutex_lock(&d->lock);
+	if (!d->found || (min_val < d->min_val))
+		d->min_val = min_val;
+	if (!d->found || (max_val > d->max_val))
+		d->max_val = max_val;
+	d->found = true;
+	pthread_mutex_unlock(&d->lock);
+}
+
+template <class T>
+static bool bandMinMax(const T *ptr, unsigned long len,
+		       double& min_val, double& max_val)
+{
+	MinMaxData data;
+	data.ptr = ptr;
+	data.len = len;
+	pthread_mutex_init(&data.lock, NULL);
+	data.found = false;
+	runBands(minMaxBlocks<T>, &data, nrBlocks(len), len);
+	pthread_mutex_destroy(&data.lock);
+
+	if (!data.found)
+		return false;
+	min_val = data.min_val;
+	max_val = data.max_val;
+	return true;
+}
+
+bool imageMinMax(const unsigned char *ptr, unsigned long len,
+		 double& min_val, double& max_val)
+{
+	return bandMinMax(ptr, len, min_val, max_val);
+}
+
+bool imageMinMax(const unsigned short *ptr, unsigned long len,
+		 double& min_val, double& max_val)
+{
+	return bandMinMax(ptr, len, min_val, max_val);
+}
+
+bool imageMinMax(const unsigned int *ptr, unsigned long len,
+		 double& min_val, double& max_val)
+{
+	return bandMinMax(ptr, len, min_val, max_val);
+}
+
+bool imageMinMax(const signed char *ptr, unsigned long len,
+		 double& min_val, double& max_val)
+{
+	return bandMinMax(ptr, len, min_val, max_val);
+}
+
+bool imageMinMax(const short *ptr, unsigned long len,
+		 double& min_val, double& max_val)
+{
+	return bandMinMax(ptr, len, min_val, max_val);
+}
+
+bool imageMinMax(const int *ptr, unsigned long len,
+		 double& min_val, double& max_val)
+{
+	return bandMinMax(ptr, len, min_val, max_val);
+}
+
+bool imageMinMax(const float *ptr, unsigned long len,
+		 double& min_val, double& max_val)
+{
+	return bandMinMax(ptr, len, min_val, max_val);
+}
+
+bool imageMinMax(const double *ptr, unsigned long len,
+		 double& min_val, double& max_val)
+{
+	return bandMinMax(ptr, len, min_val, max_val);
+}
+
+struct ConvertData {
+	const void *src;
+	unsigned long len;
+	double min_val, max_val;
+	unsigned short *dst;
+};
+
+template <class T>
+static void convertBlocks(void *data, int first, int last)
+{
+	ConvertData *d = (ConvertData *) data;
+	unsigned long begin, end;
+	blockRange(d->len, first, last, begin, end);
+	convertRange((const T *) d->src + begin, end - begin,
+		     d->min_val, d->max_val, d->dst + begin);
+}
+
+template <class T>
+static void bandConvert(const T *src, unsigned long len,
+			double min_val, double max_val, unsigned short *dst)
+{
+	ConvertData data;
+	data.src = src;
+	data.len = len;
+	data.min_val = min_val;
+	data.max_val = max_val;
+	data.dst = dst;
+	runBands(convertBlocks<T>, &data, nrBlocks(len), len);
+}
+
+void imageConvert(const float *src, unsigned long len,
+		  double min_val, double max_val, unsigned short *dst)
+{
+	bandConvert(src, len, min_val, max_val, dst);
+}
+
+void imageConvert(const double *src, unsigned long len,
+		  double min_val, double max_val, unsigned short *dst)
+{
+	bandConvert(src, len, min_val, max_val, dst);
+}
+
+
+/********************************************************************
+ * Histogram
+ *
+ * Each band counts in its own bins, added to the histogram under a
+ * lock. Exact histograms index the bins with the pixel value, the
+ * others need the min/max of the frame first
+ ********************************************************************/
+
+struct HistData {
+	const void *ptr;
+	unsigned long len;
+	double first_val, scale;
+	int nr_bins;
+	bool exact;
+	pthread_mutex_t lock;
+	unsigned long *bins;
+};
+
+template <class T>
+static void histBlocks(void *data, int first, int last)
+{
+	HistData *d = (HistData *) data;
+	unsigned long begin, end;
+	blockRange(d->len, first, last, begin, end);
+
+	// NaN/Inf go to an extra bin, dropped, so that the loop has no branch
+	const T *p = (const T *) d->ptr;
+	std::vector<unsigned int> counts(d->nr_bins + 1);
+	if (d->exact) {
+		long long offset = (long long) d->first_val;
+		for (unsigned long i = begin; i < end; ++i)
+			++counts[(long long) p[i] - offset];
+	} else {
+		double first_val = d->first_val, scale = d->scale;
+		double last_bin = d->nr_bins - 1;
+		for (unsigned long i = begin; i < end; ++i) {
+			double x = (p[i] - first_val) * scale;
+			x = (x > 0) ? x : 0;
+			x = (x < last_bin) ? x : last_bin;
+			int bin = isFinite(p[i]) ? int(x) : d->nr_bins;
+			++counts[bin];
+		}
+	}
+
+	pthread_mutex_lock(&d->lock);
+	for (int i = 0; i < d->nr_bins; ++i)
+		d->bins[i] += counts[i];
+	pthread_mutex_unlock(&d->lock);
+}
+
+template <class T>
+static bool histogram(const T *ptr, unsigned long len, ImageHistogram& hist)
+{
+	const bool is_int = std::numeric_limits<T>::is_integer;
+	double min_val = 0, max_val = 0;
+	hist.exact = is_int;
+	if (is_int && (sizeof(T) <= 2)) {
+		min_val = std::numeric_limits<T>::min();
+		max_val = std::numeric_limits<T>::max();
+	} else if (!bandMinMax(ptr, len, min_val, max_val)) {
+		hist.bins.clear();
+		hist.nr_pixels = 0;
+		return false;
+	} else if (max_val - min_val >= ImageHistBins) {
+		hist.exact = false;
+	}
+
+	int nr_bins = ImageHistBins;
+	if (hist.exact)
+		nr_bins = int(max_val - min_val) + 1;
+	hist.first_val = min_val;
+	hist.bin_width = hist.exact ? 1 : ((max_val - min_val) / nr_bins);
+	hist.bins.assign(nr_bins, 0);
+
+	HistData data;
+	data.ptr = ptr;
+	data.len = len;
+	data.first_val = hist.first_val;
+	data.scale = (hist.bin_width > 0) ? (1 / hist.bin_width) : 0;
+	data.nr_bins = nr_bins;
+	data.exact = hist.exact;
+	pthread_mutex_init(&data.lock, NULL);
+	data.bins = &hist.bins[0];
+	runBands(histBlocks<T>, &data, nrBlocks(len), len);
+	pthread_mutex_destroy(&data.lock);
+
+	hist.nr_pixels = 0;
+	for (int i = 0; i < nr_bins; ++i)
+		hist.nr_pixels += hist.bins[i];
+	if (hist.nr_pixels == 0)
+		return false;
+
+	// the extrema of exact histograms are their first/last used bins
+	if (hist.exact) {
+		int i = 0, j = nr_bins - 1;
+		while (!hist.bins[i])
+			++i;
+		while (!hist.bins[j])
+			--j;
+		min_val = hist.first_val + i;
+		max_val = hist.first_val + j;
+	}
+	hist.min_val = min_val;
+	hist.max_val = max_val;
+	return true;
+}
+
+bool imageHistogram(const unsigned char *ptr, unsigned long len,
+		    ImageHistogram& hist)
+{
+	return histogram(ptr, len, hist);
+}
+
+bool imageHistogram(const unsigned short *ptr, unsigned long len,
+		    ImageHistogram& hist)
+{
+	return histogram(ptr, len, hist);
+}
+
+bool imageHistogram(const unsigned int *ptr, unsigned long len,
+		    ImageHistogram& hist)
+{
+	return histogram(ptr, len, hist);
+}
+
+bool imageHistogram(const signed char *ptr, unsigned long len,
+		    ImageHistogram& hist)
+{
+	return histogram(ptr, len, hist);
+}
+
+bool imageHistogram(const short *ptr, unsigned long len,
+		    ImageHistogram& hist)
+{
+	return histogram(ptr, len, hist);
+}
+
+bool imageHistogram(const int *ptr, unsigned long len,
+		    ImageHistogram& hist)
+{
+	return histogram(ptr, len, hist);
+}
+
+bool imageHistogram(const float *ptr, unsigned long len,
+		    ImageHistogram& hist)
+{
+	return histogram(ptr, len, hist);
+}
+
+bool imageHistogram(const double *ptr, unsigned long len,
+		    ImageHistogram& hist)
+{
+	return histogram(ptr, len, hist);
+}
+
+double imageHistPercentile(const ImageHistogram& hist, double fraction)
+{
+	if (hist.nr_pixels == 0)
+		return 0;
+	if (fraction <= 0)
+		return hist.min_val;
+	if (fraction >= 1)
+		return hist.max_val;
+
+	// the rank of the pixel in the sorted frame, from 0
+	double rank = fraction * (hist.nr_pixels - 1);
+	unsigned long count = 0;
+	unsigned long i = 0;
+	for (; i < hist.bins.size() - 1; ++i) {
+		if (count + hist.bins[i] > rank)
+			break;
+		count += hist.bins[i];
+	}
+
+	if (hist.exact)
+		return hist.first_val + i;
+	double pos = (rank - count) / max(hist.bins[i], 1UL);
+	double val = hist.first_val + (i + pos) * hist.bin_width;
+	return min(max(val, hist.min_val), hist.max_val);
+}
+
+
+/********************************************************************
+ * Sampled histogram
+ ********************************************************************/
+
+template <class T>
+static bool sampleHistogram(const T *ptr, unsigned long len,
+			    unsigned long nr_samples, ImageHistogram& hist)
+{
+	if (len <= nr_samples)
+		return histogram(ptr, len, hist);
+
+	// runs of len / nr_samples pixels, the boundaries being rounded
+	std::vector<T> samples(nr_samples);
+	unsigned int seed = 0x9e3779b9;
+	for (unsigned long i = 0; i < nr_samples; ++i) {
+		unsigned long begin = (unsigned long)
+			((unsigned long long) len * i / nr_samples);
+		unsigned long end = (unsigned long)
+			((unsigned long long) len * (i + 1) / nr_samples);
+		seed = seed * 1664525 + 1013904223;
+		unsigned long offset = (unsigned long)
+			((unsigned long long) (seed >> 8) * (end - begin) >> 24);
+		samples[i] = ptr[begin + offset];
+	}
+	return histogram(&samples[0], nr_samples, hist);
+}
+
+bool imageSampleHistogram(const unsigned char *ptr, unsigned long len,
+			  unsigned long nr_samples, ImageHistogram& hist)
+{
+	return sampleHistogram(ptr, len, nr_samples, hist);
+}
+
+bool imageSampleHistogram(const unsigned short *ptr, unsigned long len,
+			  unsigned long nr_samples, ImageHistogram& hist)
+{
+	return sampleHistogram(ptr, len, nr_samples, hist);
+}
+
+bool imageSampleHistogram(const unsigned int *ptr, unsigned long len,
+			  unsigned long nr_samples, ImageHistogram& hist)
+{
+	return sampleHistogram(ptr, len, nr_samples, hist);
+}
+
+bool imageSampleHistogram(const signed char *ptr, unsigned long len,
+			  unsigned long nr_samples, ImageHistogram& hist)
+{
+	return sampleHistogram(ptr, len, nr_samples, hist);
+}
+
+bool imageSampleHistogram(const short *ptr, unsigned long len,
+			  unsigned long nr_samples, ImageHistogram& hist)
+{
+	return sampleHistogram(ptr, len, nr_samples, hist);
+}
+
+bool imageSampleHistogram(const int *ptr, unsigned long len,
+			  unsigned long nr_samples, ImageHistogram& hist)
+{
+	return sampleHistogram(ptr, len, nr_samples, hist);
+}
+
+bool imageSampleHistogram(const float *ptr, unsigned long len,
+			  unsigned long nr_samples, ImageHistogram& hist)
+{
+	return sampleHistogram(ptr, len, nr_samples, hist);
+}
+
+bool imageSampleHistogram(const double *ptr, unsigned long len,
+			  unsigned long nr_samples, ImageHistogram& hist)
+{
+	return sampleHistogram(ptr, len, nr_samples, hist);
+}
+
+// P(error > eps) <= 2 exp(-2 n eps^2) = 0.01
+double imageSampleError(unsigned long nr_samples)
+{
+	if (nr_samples == 0)
+		return 1;
+	return sqrt(log(2 / 0.01) / (2.0 * nr_samples));
+}
+
+
+/********************************************************************
+ * Subsampling
+ ********************************************************************/
+
+template <class T>
+static void subsample(const T *src, int width, int height, int step,
+		      T *dst)
+{
+	int dst_width = (width + step - 1) / step;
+	int dst_height = (height + step - 1) / step;
+	for (int i = 0; i < dst_height; ++i) {
+		const T *p = src + (unsigned long) i * step * width;
+		for (int j = 0; j < dst_width; ++j, p += step)
+			*dst++ = *p;
+	}
+}
+
+void imageSubsample(const void *src, int width, int height, int depth,
+		    int step, void *dst)
+{
+	switch (depth) {
+	case 1:
+		subsample((const unsigned char *) src, width, height, step,
+			  (unsigned char *) dst);
+		break;
+	case 2:
+		subsample((const unsigned short *) src, width, height, step,
+			  (unsigned short *) dst);
+		break;
+	case 4:
+		subsample((const unsigned int *) src, width, height, step,
+			  (unsigned int *) dst);
+		break;
+	case 8:
+		subsample((const unsigned long long *) src, width, height,
+			  step, (unsigned long long *) dst);
+		break;
+	}
+}
+
+
+/********************************************************************
+ * Max-pooling decimation
+ *
+ * The rows of a block are first reduced into a line, with SIMD when
+ * available, then each group of step pixels of the line
+ ********************************************************************/
+
+template <class T>
+static inline T lowestValue()
+{
+	return std::numeric_limits<T>::min();
+}
+
+template <>
+inline float lowestValue<float>()
+{
+	return -HUGE_VALF;
+}
+
+template <>
+inline double lowestValue<double>()
+{
+	return -HUGE_VAL;
+}
+
+template <class T>
+static inline void maxLine(T *acc, const T *src, int len)
+{
+	for (int j = 0; j < len; ++j)
+		acc[j] = max(acc[j], src[j]);
+}
+
+// non-finite pixels are not taken into account
+template <>
+inline void maxLine<double>(double *acc, const double *src, int len)
+{
+	for (int j = 0; j < len; ++j)
+		if (isFinite(src[j]) && (src[j] > acc[j]))
+			acc[j] = src[j];
+}
+
+#ifdef __SSE2__
+
+template <>
+inline void maxLine<unsigned char>(unsigned char *acc,
+				   const unsigned char *src, int len)
+{
+	int j = 0;
+	for (; j + 16 <= len; j += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i *) (acc + j));
+		__m128i v = _mm_loadu_si128((const __m128i *) (src + j));
+		_mm_storeu_si128((__m128i *) (acc + j), _mm_max_epu8(a, v));
+	}
+	for (; j < len; ++j)
+		acc[j] = max(acc[j], src[j]);
+}
+
+template <>
+inline void maxLine<short>(short *acc, const short *src, int len)
+{
+	int j = 0;
+	for (; j + 8 <= len; j += 8) {
+		__m128i a = _mm_loadu_si128((const __m128i *) (acc + j));
+		__m128i v = _mm_loadu_si128((const __m128i *) (src + j));
+		_mm_storeu_si128((__m128i *) (acc + j), _mm_max_epi16(a, v));
+	}
+	for (; j < len; ++j)
+		acc[j] = max(acc[j], src[j]);
+}
+
+// SSE2 has only signed 16-bit max: flip the sign bit
+template <>
+inline void maxLine<unsigned short>(unsigned short *acc,
+				    const unsigned short *src, int len)
+{
+	const __m128i bias = _mm_set1_epi16(short(0x8000));
+	int j = 0;
+	for (; j + 8 <= len; j += 8) {
+		__m128i a = _mm_loadu_si128((const __m128i *) (acc + j));
+		__m128i v = _mm_loadu_si128((const __m128i *) (src + j));
+		a = _mm_xor_si128(a, bias);
+		v = _mm_xor_si128(v, bias);
+		a = _mm_xor_si128(_mm_max_epi16(a, v), bias);
+		_mm_storeu_si128((__m128i *) (acc + j), a);
+	}
+	for (; j < len; ++j)
+		acc[j] = max(acc[j], src[j]);
+}
+
+template <>
+inline void maxLine<int>(int *acc, const int *src, int len)
+{
+	int j = 0;
+	for (; j + 4 <= len; j += 4) {
+		__m128i a = _mm_loadu_si128((const __m128i *) (acc + j));
+		__m128i v = _mm_loadu_si128((const __m128i *) (src + j));
+		_mm_storeu_si128((__m128i *) (acc + j), maxEpi32(a, v));
+	}
+	for (; j < len; ++j)
+		acc[j] = max(acc[j], src[j]);
+}
+
+template <>
+inline void maxLine<unsigned int>(unsigned int *acc, 
+				  const unsigned int *src, int len)
+{
+	const __m128i bias = _mm_set1_epi32(int(0x80000000));
+	int j = 0;
+	for (; j + 4 <= len; j += 4) {
+		__m128i a = _mm_loadu_si128((const __m128i *) (acc + j));
+		__m128i v = _mm_loadu_si128((const __m128i *) (src + j));
+		a = _mm_xor_si128(a, bias);
+		v = _mm_xor_si128(v, bias);
+		a = _mm_xor_si128(maxEpi32(a, v), bias);
+		_mm_storeu_si128((__m128i *) (acc + j), a);
+	}
+	for (; j < len; ++j)
+		acc[j] = max(acc[j], src[j]);
+}
+
+template <>
+inline void maxLine<float>(float *acc, const float *src, int len)
+{
+	const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	const __m128 inf = _mm_set1_ps(HUGE_VALF);
+	int j = 0;
+	for (; j + 4 <= len; j += 4) {
+		__m128 a = _mm_loadu_ps(acc + j);
+		__m128 v = _mm_loadu_ps(src + j);
+		__m128 finite = _mm_cmplt_ps(_mm_and_ps(v, abs_mask), inf);
+		v = _mm_or_ps(_mm_and_ps(finite, v), 
+			      _mm_andnot_ps(finite, a));
+		_mm_storeu_ps(acc + j, _mm_max_ps(a, v));
+	}
+	for (; j < len; ++j)
+		if (isFinite(src[j]) && (src[j] > acc[j]))
+			acc[j] = src[j];
+}
+
+#else
+
+template <>
+inline void maxLine<float>(float *acc, const float *src, int len)
+{
+	for (int j = 0; j < len; ++j)
+		if (isFinite(src[j]) && (src[j] > acc[j]))
+			acc[j] = src[j];
+}
+
+#endif
+
+template <class T>
+struct DecimateData {
+	const T *src;
+	int width, height, step;
+	T *dst;
+};
+
+// the last block row and column can be partial
+template <class T>
+static void decimateRows(void *data, int first, int last)
+{
+	DecimateData<T> *d = (DecimateData<T> *) data;
+	int width = d->width, step = d->step;
+	int dst_width = (width + step - 1) / step;
+	std::vector<T> line(width);
+
+	for (int i = first; i < last; ++i) {
+		const T *src = d->src + (unsigned long) i * step * width;
+		int rows = min(step, d->height - i * step);
+		std::fill(line.begin(), line.end(), lowestValue<T>());
+		for (int k = 0; k < rows; ++k, src += width)
+			maxLine(&line[0], src, width);
+
+		T *dst = d->dst + (unsigned long) i * dst_width;
+		for (int j = 0; j < dst_width; ++j) {
+			const T *p = &line[j * step];
+			int cols = min(step, width - j * step);
+			T val = p[0];
+			for (int k = 1; k < cols; ++k)
+				val = max(val, p[k]);
+			dst[j] = val;
+		}
+	}
+}
+
+template <class T>
+static void decimateMax(const T *src, int width, int height, int step,
+			T *dst)
+{
+	if ((step < 1) || (width < 1) || (height < 1))
+		return;
+
+	DecimateData<T> data = {src, width, height, step, dst};
+	unsigned long nr_pixels = (unsigned long) width * height;
+	runBands(decimateRows<T>, &data, (height + step - 1) / step, 
+		 nr_pixels);
+}
+
+void imageDecimateMax(const unsigned char *src, int width, int height,
+		      int step, unsigned char *dst)
+{
+	decimateMax(src, width, height, step, dst);
+}
+
+void imageDecimateMax(const unsigned short *src, int width, int height,
+		      int step, unsigned short *dst)
+{
+	decimateMax(src, width, height, step, dst);
+}
+
+void imageDecimateMax(const unsigned int *src, int width, int height,
+		      int step, unsigned int *dst)
+{
+	decimateMax(src, width, height, step, dst);
+}
+
+void imageDecimateMax(const signed char *src, int width, int height,
+		      int step, signed char *dst)
+{
+	decimateMax(src, width, height, step, dst);
+}
+
+void imageDecimateMax(const short *src, int width, int height,
+		      int step, short *dst)
+{
+	decimateMax(src, width, height, step, dst);
+}
+
+void imageDecimateMax(const int *src, int width, int height,
+		      int step, int *dst)
+{
+	decimateMax(src, width, height, step, dst);
+}
+
+void imageDecimateMax(const float *src, int width, int height,
+		      int step, float *dst)
+{
+	decimateMax(src, width, height, step, dst);
+}
+
+void imageDecimateMax(const double *src, int width, int height,
+		      int step, double *dst)
+{
+	decimateMax(src, width, height, step, dst);
+}
+
+
+/********************************************************************
+ * Pyramid
+ *
+ * Each level halves the previous one. Max keeps the hot pixels like
+ * imageDecimateMax, mean averages the finite pixels of each block
+ ********************************************************************/
+
+template <class T>
+static inline T meanPixel(double sum, int n)
+{
+	if (!n)
+		return lowestValue<T>();
+	double val = sum / n;
+	if (std::numeric_limits<T>::is_integer)
+		val = floor(val + 0.5);
+	return T(val);
+}
+
+static inline void addFinite(double val, double& sum, int& n)
+{
+	if (isFinite(val)) {
+		sum += val;
+		++n;
+	}
+}
+
+template <class T>
+struct ReduceData {
+	const T *src;
+	int width, height, src_stride;
+	bool use_max;
+	T *dst;
+	int dst_stride;
+};
+
+template <class T>
+static void reduceRows(void *data, int first, int last)
+{
+	ReduceData<T> *d = (ReduceData<T> *) data;
+	int width = d->width;
+	int dst_width = (width + 1) / 2;
+	std::vector<T> line(width);
+
+	for (int i = first; i < last; ++i) {
+		const T *src0 = d->src + (long) 2 * i * d->src_stride;
+		const T *src1 = src0;
+		if (2 * i + 1 < d->height)
+			src1 += d->src_stride;
+		T *dst = d->dst + (long) i * d->dst_stride;
+
+		if (d->use_max) {
+			std::fill(line.begin(), line.end(), lowestValue<T>());
+			maxLine(&line[0], src0, width);
+			maxLine(&line[0], src1, width);
+			const T *p = &line[0];
+			for (int j = 0; j < width / 2; ++j, p += 2)
+				dst[j] = max(p[0], p[1]);
+			if (width & 1)
+				dst[dst_width - 1] = *p;
+			continue;
+		}
+
+		// odd edges: a block of 1 pixel in that direction
+		bool two_rows = (src1 != src0);
+		for (int j = 0; j < dst_width; ++j) {
+			int k = 2 * j;
+			bool two_cols = (k + 1 < width);
+			double sum = 0;
+			int n = 0;
+			addFinite(src0[k], sum, n);
+			if (two_cols)
+				addFinite(src0[k + 1], sum, n);
+			if (two_rows)
+				addFinite(src1[k], sum, n);
+			if (two_rows && two_cols)
+				addFinite(src1[k + 1], sum, n);
+			dst[j] = meanPixel<T>(sum, n);
+		}
+	}
+}
+
+template <class T>
+static void reduce(const T *src, int width, int height, int src_stride,
+		   bool use_max, T *dst, int dst_stride)
+{
+	if ((width < 1) || (height < 1))
+		return;
+
+	ReduceData<T> data = {src, width, height, src_stride, use_max, dst,
+			      dst_stride};
+	unsigned long nr_pixels = (unsigned long) width * height;
+	runBands(reduceRows<T>, &data, (height + 1) / 2, nr_pixels);
+}
+
+void imageReduce(const unsigned char *src, int width, int height,
+		 int src_stride, bool use_max, unsigned char *dst,
+		 int dst_stride)
+{
+	reduce(src, width, height, src_stride, use_max, dst, dst_stride);
+}
+
+void imageReduce(const unsigned short *src, int width, int height,
+		 int src_stride, bool use_max, unsigned short *dst,
+		 int dst_stride)
+{
+	reduce(src, width, height, src_stride, use_max, dst, dst_stride);
+}
+
+void imageReduce(const unsigned int *src, int width, int height,
+		 int src_stride, bool use_max, unsigned int *dst,
+		 int dst_stride)
+{
+	reduce(src, width, height, src_stride, use_max, dst, dst_stride);
+}
+
+void imageReduce(const signed char *src, int width, int height,
+		 int src_stride, bool use_max, signed char *dst,
+		 int dst_stride)
+{
+	reduce(src, width, height, src_stride, use_max, dst, dst_stride);
+}
+
+void imageReduce(const short *src, int width, int height,
+		 int src_stride, bool use_max, short *dst,
+		 int dst_stride)
+{
+	reduce(src, width, height, src_stride, use_max, dst, dst_stride);
+}
+
+void imageReduce(const int *src, int width, int height,
+		 int src_stride, bool use_max, int *dst,
+		 int dst_stride)
+{
+	reduce(src, width, height, src_stride, use_max, dst, dst_stride);
+}
+
+void imageReduce(const float *src, int width, int height,
+		 int src_stride, bool use_max, float *dst,
+		 int dst_stride)
+{
+	reduce(src, width, height, src_stride, use_max, dst, dst_stride);
+}
+
+void imageReduce(const double *src, int width, int height,
+		 int src_stride, bool use_max, double *dst,
+		 int dst_stride)
+{
+	reduce(src, width, height, src_stride, use_max, dst, dst_stride);
+}
+
+
+/********************************************************************
+ * Colormap
+ ********************************************************************/
+
+#ifdef __SSE2__
+
+// idx = clip(val * scale, 0, ImageLutSize - 1), 0 if val is not finite
+static void lutIndex(const float *val, int len, float scale, int *idx)
+{
+	const __m128 s = _mm_set1_ps(scale);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 top = _mm_set1_ps(ImageLutSize - 1);
+	const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	const __m128 fmax = _mm_set1_ps(std::numeric_limits<float>::max());
+	int j = 0;
+	for (; j + 4 <= len; j += 4) {
+		__m128 v = _mm_loadu_ps(val + j);
+		__m128 finite = _mm_cmple_ps(_mm_and_ps(v, abs_mask), fmax);
+		v = _mm_and_ps(_mm_mul_ps(v, s), finite);
+		v = _mm_min_ps(_mm_max_ps(v, zero), top);
+		_mm_storeu_si128((__m128i *) (idx + j), _mm_cvttps_epi32(v));
+	}
+	for (; j < len; ++j) {
+		float v = val[j] * scale;
+		idx[j] = isFinite(val[j]) ? int(min(max(v, 0.0f), 
+						      float(ImageLutSize - 1)))
+					  : 0;
+	}
+}
+
+#else
+
+static void lutIndex(const float *val, int len, float scale, int *idx)
+{
+	for (int j = 0; j < len; ++j) {
+		float v = val[j] * scale;
+		idx[j] = isFinite(val[j]) ? int(min(max(v, 0.0f), 
+						      float(ImageLutSize - 1)))
+					  : 0;
+	}
+}
+
+#endif
+
+template <class T>
+struct ColormapData {
+	const T *src;
+	int width, height;
+	double min_val;
+	float scale;
+	const unsigned int *lut;
+	unsigned int *dst;
+	int dst_width, dst_height, dst_stride;
+	const int *cols;
+};
+
+// the source pixels are gathered relative to min_val in double, so
+// that float keeps the precision of large integer values
+template <class T>
+static void colormapRows(void *data, int first, int last)
+{
+	ColormapData<T> *d = (ColormapData<T> *) data;
+	int len = d->dst_width;
+	std::vector<float> val(len);
+	std::vector<int> idx(len);
+
+	for (int i = first; i < last; ++i) {
+		long row = (long long) i * d->height / d->dst_height;
+		const T *src = d->src + row * d->width;
+		for (int j = 0; j < len; ++j)
+			val[j] = float(double(src[d->cols[j]]) - d->min_val);
+		lutIndex(&val[0], len, d->scale, &idx[0]);
+
+		unsigned int *dst = d->dst + (long) i * d->dst_stride;
+		for (int j = 0; j < len; ++j)
+			dst[j] = d->lut[idx[j]];
+	}
+}
+
+template <class T>
+static void colormap(const T *src, int width, int height, double min_val,
+		     double max_val, const unsigned int *lut, 
+		     unsigned int *dst, int dst_width, int dst_height,
+		     int dst_stride)
+{
+	if ((width < 1) || (height < 1) || (dst_width < 1) || 
+	    (dst_height < 1))
+		return;
+
+	std::vector<int> cols(dst_width);
+	for (int j = 0; j < dst_width; ++j)
+		cols[j] = int((long long) j * width / dst_width);
+
+	double range = max_val - min_val;
+	float scale = (range > 0) ? float(ImageLutSize / range) : 0;
+	ColormapData<T> data = {src, width, height, min_val, scale, lut, dst,
+				dst_width, dst_height, dst_stride, &cols[0]};
+	unsigned long nr_pixels = (unsigned long) dst_width * dst_height;
+	runBands(colormapRows<T>, &data, dst_height, nr_pixels);
+}
+
+void imageColormap(const unsigned char *src, int width, int height,
+		   double min_val, double max_val, const unsigned int *lut,
+		   unsigned int *dst, int dst_width, int dst_height,
+		   int dst_stride)
+{
+	colormap(src, width, height, min_val, max_val, lut, dst, dst_width,
+		 dst_height, dst_stride);
+}
+
+void imageColormap(const unsigned short *src, int width, int height,
+		   double min_val, double max_val, const unsigned int *lut,
+		   unsigned int *dst, int dst_width, int dst_height,
+		   int dst_stride)
+{
+	colormap(src, width, height, min_val, max_val, lut, dst, dst_width,
+		 dst_height, dst_stride);
+}
+
+void imageColormap(const unsigned int *src, int width, int height,
+		   double min_val, double max_val, const unsigned int *lut,
+		   unsigned int *dst, int dst_width, int dst_height,
+		   int dst_stride)
+{
+	colormap(src, width, height, min_val, max_val, lut, dst, dst_width,
+		 dst_height, dst_stride);
+}
+
+void imageColormap(const signed char *src, int width, int height,
+		   double min_val, double max_val, const unsigned int *lut,
+		   unsigned int *dst, int dst_width, int dst_height,
+		   int dst_stride)
+{
+	colormap(src, width, height, min_val, max_val, lut, dst, dst_width,
+		 dst_height, dst_stride);
+}
+
+void imageColormap(const short *src, int width, int height,
+		   double min_val, double max_val, const unsigned int *lut,
+		   unsigned int *dst, int dst_width, int dst_height,
+		   int dst_stride)
+{
+	colormap(src, width, height, min_val, max_val, lut, dst, dst_width,
+		 dst_height, dst_stride);
+}
+
+void imageColormap(const int *src, int width, int height,
+		   double min_val, double max_val, const unsigned int *lut,
+		   unsigned int *dst, int dst_width, int dst_height,
+		   int dst_stride)
+{
+	colormap(src, width, height, min_val, max_val, lut, dst, dst_width,
+		 dst_height, dst_stride);
+}
+
+void imageColormap(const float *src, int width, int height,
+		   double min_val, double max_val, const unsigned int *lut,
+		   unsigned int *dst, int dst_width, int dst_height,
+		   int dst_stride)
+{
+	colormap(src, width, height, min_val, max_val, lut, dst, dst_width,
+		 dst_height, dst_stride);
+}
+
+void imageColormap(const double *src, int width, int height,
+		   double min_val, double max_val, const unsigned int *lut,
+		   unsigned int *dst, int dst_width, int dst_height,
+		   int dst_stride)
+{
+	colormap(src, width, height, min_val, max_val, lut, dst, dst_width,
+		 dst_height, dst_stride);
+}
+
+
+/********************************************************************
+ * Hash
+ ********************************************************************/
+
+static const unsigned long long HashMult = 0x9e3779b97f4a7c15ULL;
+
+static inline unsigned long long loadWord(const unsigned char *ptr)
+{
+	unsigned long long w;
+	memcpy(&w, ptr, sizeof(w));
+	return w;
+}
+
+static inline unsigned long long rotl(unsigned long long h, int r)
+{
+	return (h << r) | (h >> (64 - r));
+}
+
+// each lane is a chain of bijections of its words: (h ^ w) * odd. The 
+// four independent lanes hide the multiply latency
+unsigned long long imageHash(const void *data, int row_bytes, int nr_rows,
+			     long stride)
+{
+	unsigned long long h0 = 0, h1 = 1, h2 = 2, h3 = 3;
+	const unsigned char *row = (const unsigned char *) data;
+	for (int i = 0; i < nr_rows; ++i, row += stride) {
+		const unsigned char *ptr = row, *end = row + row_bytes;
+		for (; ptr + 32 <= end; ptr += 32) {
+			h0 = (h0 ^ loadWord(ptr))      * HashMult;
+			h1 = (h1 ^ loadWord(ptr + 8))  * HashMult;
+			h2 = (h2 ^ loadWord(ptr + 16)) * HashMult;
+			h3 = (h3 ^ loadWord(ptr + 24)) * HashMult;
+		}
+		for (; ptr + 8 <= end; ptr += 8)
+			h0 = (h0 ^ loadWord(ptr)) * HashMult;
+		for (; ptr < end; ++ptr)
+			h1 = (h1 ^ *ptr) * HashMult;
+	}
+	return h0 ^ rotl(h1, 16) ^ rotl(h2, 32) ^ rotl(h3, 48);
+}
@@ -0,0 +1,148 @@
+//###########################################################################
+// This file is part of gldisplay, a submodule of LImA project the
+// Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+
+#include "imageproc.h"
+#include "prectime.h"
+
+using namespace std;
+
+// CPU cost of bringing a large frame to a small window, and the number
+// of bytes then uploaded to GL, or sent to X by the Software mode
+//
+// Usage: bench_imageproc [width height view_size nb_frames]
+
+template <class T>
+void bench(const char *name, int width, int height, int view_size,
+	   int nb_frames)
+{
+	vector<T> src((unsigned long) width * height);
+	for (unsigned long i = 0; i < src.size(); ++i)
+		src[i] = T(i % 1000);
+
+	int step = max(1, max(width, height) / view_size);
+	int dst_width = (width + step - 1) / step;
+	int dst_height = (height + step - 1) / step;
+	vector<T> full(src.size());
+	vector<T> dst((unsigned long) dst_width * dst_height);
+	// Software render mode: colormapped 32-bit pixels sent to X
+	vector<unsigned int> lut(ImageLutSize), rgb(dst.size());
+	// pyramid: halved until the level fits in the view
+	vector<T> level(src.size() / 4 + width + height);
+	int level_width = width, level_height = height;
+
+	cout << name << " " << width << "x" << height << " -> "
+	     << dst_width << "x" << dst_height << " (step " << step << ")"
+	     << endl;
+
+	for (int mode = 0; mode < 5; ++mode) {
+		const char *mode_name;
+		unsigned long bytes;
+		PrecTime t0(PrecTime::Now);
+		for (int i = 0; i < nb_frames; ++i) {
+			switch (mode) {
+			case 0:
+				memcpy(&full[0], &src[0], 
+				       src.size() * sizeof(T));
+				break;
+			case 1:
+				imageSubsample(&src[0], width, height, 
+					       sizeof(T), step, &dst[0]);
+				break;
+			case 2:
+				imageDecimateMax(&src[0], width, height, 
+						 step, &dst[0]);
+				break;
+			case 3:
+				imageColormap(&src[0], width, height, 0, 1000,
+					      &lut[0], &rgb[0], dst_width, 
+					      dst_height, dst_width);
+				break;
+			case 4:
+				level_width = width;
+				level_height = height;
+				for (const T *p = &src[0]; 
+				     max(level_width, level_height) > 
+				     view_size; p = &level[0]) {
+					imageReduce(p, level_width, 
+						    level_height, level_width,
+						    true, &level[0], 
+						    (level_width + 1) / 2);
+					level_width = (level_width + 1) / 2;
+					level_height = (level_height + 1) / 2;
+				}
+				break;
+			}
+		}
+		double elapsed = PrecTime::now() - t0;
+
+		switch (mode) {
+		case 0:
+			mode_name = "full copy";
+			bytes = full.size() * sizeof(T);
+			break;
+		case 1:
+			mode_name = "subsample";
+			bytes = dst.size() * sizeof(T);
+			break;
+		case 2:
+			mode_name = "max-pool";
+			bytes = dst.size() * sizeof(T);
+			break;
+		case 3:
+			mode_name = "colormap";
+			bytes = rgb.size() * sizeof(unsigned int);
+			break;
+		default:
+			mode_name = "pyramid";
+			bytes = (unsigned long) level_width * level_height * 
+				sizeof(T);
+			break;
+		}
+		cout << "  " << setw(10) << left << mode_name << right
+		     << fixed << setprecision(3) 
+		     << setw(9) << elapsed / nb_frames * 1e3 << " ms/frame, "
+		     << setw(10) << bytes << " bytes uploaded" << endl;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	int width = 4096, height = 4096, view_size = 512, nb_frames = 20;
+	if (argc > 4) {
+		width = atoi(argv[1]);
+		height = atoi(argv[2]);
+		view_size = atoi(argv[3]);
+		nb_frames = atoi(argv[4]);
+	}
+
+	bench<unsigned short>("uint16", width, height, view_size, nb_frames);
+	bench<unsigned int>("uint32", width, height, view_size, nb_frames);
+	bench<float>("float", width, height, view_size, nb_frames);
+
+	return 0;
+}
@@ -0,0 +1,148 @@
+//###########################################################################
+// This file is part of gldisplay, a submodule of LImA project the
+// Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#include <stdlib.h>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+
+#include "imageproc.h"
+#include "prectime.h"
+
+using namespace std;
+
+// Autorange min/max of a frame with each instruction set the integer
+// kernels can use. The scalar level is the loop used before SIMD.
+// The percentile autorange goes through the histogram, of the whole
+// frame or of nr_samples pixels. The error of the sampled percentiles
+// is the distance of their rank in the frame to the requested one
+//
+// Usage: bench_minmax [width height nb_frames [nr_samples]]
+
+// fraction of the pixels below val: [strictly below, below or equal]
+template <class T>
+double rankError(const vector<T>& src, double val, double fraction)
+{
+	unsigned long below = 0, equal = 0;
+	for (unsigned long i = 0; i < src.size(); ++i) {
+		below += (src[i] < val);
+		equal += (src[i] == val);
+	}
+	double low = double(below) / src.size();
+	double high = double(below + equal) / src.size();
+	if (fraction < low)
+		return low - fraction;
+	if (fraction > high)
+		return fraction - high;
+	return 0;
+}
+
+template <class T>
+void bench(const char *name, int width, int height, int nb_frames,
+	   unsigned long nr_samples)
+{
+	vector<T> src((unsigned long) width * height);
+	for (unsigned long i = 0; i < src.size(); ++i)
+		src[i] = T(i * 2654435761U >> 11);
+
+	cout << name << " " << width << "x" << height << endl;
+
+	static const char *simd_name[] = {"scalar", "SSE2", "AVX2"};
+	double scalar_time = 0;
+	for (int simd = ImageSimdNone; simd <= ImageSimdAvx2; ++simd) {
+		if (imageSetSimd(simd) != simd)
+			continue;
+
+		double min_val = 0, max_val = 0;
+		PrecTime t0(PrecTime::Now);
+		for (int i = 0; i < nb_frames; ++i)
+			imageMinMax(&src[0], src.size(), min_val, max_val);
+		double elapsed = (PrecTime::now() - t0) / nb_frames;
+		if (simd == ImageSimdNone)
+			scalar_time = elapsed;
+
+		double bytes = double(src.size()) * sizeof(T);
+		cout << "  " << setw(8) << left << simd_name[simd] << right
+		     << fixed << setprecision(3)
+		     << setw(9) << elapsed * 1e3 << " ms/frame, "
+		     << setw(7) << setprecision(2) << bytes / elapsed / 1e9
+		     << " GB/s, x" << setprecision(1)
+		     << scalar_time / elapsed
+		     << " [" << min_val << ", " << max_val << "]" << endl;
+	}
+	imageSetSimd(ImageSimdAvx2);
+
+	ImageHistogram hist;
+	double low = 0, high = 0;
+	PrecTime t0(PrecTime::Now);
+	for (int i = 0; i < nb_frames; ++i) {
+		imageHistogram(&src[0], src.size(), hist);
+		low = imageHistPercentile(hist, 0.001);
+		high = imageHistPercentile(hist, 0.999);
+	}
+	double elapsed = (PrecTime::now() - t0) / nb_frames;
+	cout << "  " << setw(8) << left << "hist" << right
+	     << fixed << setprecision(3)
+	     << setw(9) << elapsed * 1e3 << " ms/frame, "
+	     << hist.bins.size() << " bins"
+	     << setprecision(1) << " [" << low << ", " << high << "]" << endl;
+
+	t0 = PrecTime::now();
+	for (int i = 0; i < nb_frames; ++i) {
+		imageSampleHistogram(&src[0], src.size(), nr_samples, hist);
+		low = imageHistPercentile(hist, 0.001);
+		high = imageHistPercentile(hist, 0.999);
+	}
+	elapsed = (PrecTime::now() - t0) / nb_frames;
+	double error = max(rankError(src, low, 0.001),
+			   rankError(src, high, 0.999));
+	cout << "  " << setw(8) << left << "sampled" << right
+	     << fixed << setprecision(3)
+	     << setw(9) << elapsed * 1e3 << " ms/frame, "
+	     << hist.nr_pixels << " samples"
+	     << setprecision(1) << " [" << low << ", " << high << "]"
+	     << setprecision(4) << ", rank error " << error
+	     << " (bound " << imageSampleError(hist.nr_pixels) << ")" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+	int width = 4096, height = 4096, nb_frames = 20;
+	unsigned long nr_samples = 65536;
+	if (argc > 3) {
+		width = atoi(argv[1]);
+		height = atoi(argv[2]);
+		nb_frames = atoi(argv[3]);
+	}
+	if (argc > 4)
+		nr_samples = atol(argv[4]);
+
+	bench<unsigned char>("uint8", width, height, nb_frames, nr_samples);
+	bench<signed char>("int8", width, height, nb_frames, nr_samples);
+	bench<unsigned short>("uint16", width, height, nb_frames, nr_samples);
+	bench<short>("int16", width, height, nb_frames, nr_samples);
+	bench<unsigned int>("uint32", width, height, nb_frames, nr_samples);
+	bench<int>("int32", width, height, nb_frames, nr_samples);
+	bench<float>("float", width, height, nb_frames, nr_samples);
+
+	return 0;
+}
@@ -0,0 +1,162 @@
+//###########################################################################
+// This file is part of gldisplay, a submodule of LImA project the
+// Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#include "framering.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+int nb_errors = 0;
+
+#define CHECK(cond)							\
+	do {								\
+		if (!(cond)) {						\
+			cerr << __FILE__ << ":" << __LINE__ << ": "	\
+			     << "check failed: " << #cond << endl;	\
+			++nb_errors;					\
+		}							\
+	} while (0)
+
+struct Frame {
+	void *buffer;
+	long nb;
+	Frame() : buffer(NULL), nb(-1) {}
+	Frame(void *b, long n) : buffer(b), nb(n) {}
+};
+
+// a window late for many frames shows the newest one
+void testNoConsumer()
+{
+	const int nb_frames = 10;
+	vector<long> buffer(nb_frames);
+	FrameRing<Frame> ring;
+	for (int i = 0; i < nb_frames; ++i)
+		ring.publish(Frame(&buffer[i], i));
+
+	// all but the newest one are replaced
+	void *ptr = NULL;
+	for (int i = 0; i < nb_frames - 1; ++i) {
+		CHECK(ring.reclaim(ptr));
+		CHECK(ptr == &buffer[i]);
+	}
+	CHECK(!ring.reclaim(ptr));
+
+	Frame frame;
+	CHECK(ring.takeNewest(frame));
+	CHECK(frame.nb == nb_frames - 1);
+	CHECK(frame.buffer == &buffer[nb_frames - 1]);
+	CHECK(!ring.takeNewest(frame));
+	CHECK(!ring.reclaim(ptr));
+}
+
+// the frame taken is kept until another one is taken
+void testRelease()
+{
+	long a, b;
+	FrameRing<Frame> ring;
+	Frame frame;
+	void *ptr = NULL;
+	ring.publish(Frame(&a, 0));
+	CHECK(ring.takeNewest(frame) && (frame.buffer == &a));
+	ring.publish(Frame(&b, 1));
+	CHECK(!ring.reclaim(ptr));
+	CHECK(ring.takeNewest(frame) && (frame.buffer == &b));
+	CHECK(ring.reclaim(ptr) && (ptr == &a));
+	CHECK(!ring.reclaim(ptr));
+}
+
+struct ThreadData {
+	FrameRing<Frame> *ring;
+	long nb_frames;
+	volatile bool done;
+	long nb_taken;
+	bool in_order;
+};
+
+static void *consumer(void *arg)
+{
+	ThreadData *d = (ThreadData *) arg;
+	Frame frame;
+	long last = -1;
+	while (last != d->nb_frames - 1) {
+		if (!d->ring->takeNewest(frame))
+			continue;
+		// the buffer holds its frame number until handed back
+		if ((*(long *) frame.buffer != frame.nb) ||
+		    (frame.nb <= last))
+			d->in_order = false;
+		last = frame.nb;
+		++d->nb_taken;
+	}
+	d->done = true;
+	return NULL;
+}
+
+// a handed back buffer is no longer read: it can be written at once
+void testThreads()
+{
+	const int nb_buffers = 8;
+	vector<long> buffer(nb_buffers);
+	vector<void *> free_list;
+	for (int i = 0; i < nb_buffers; ++i)
+		free_list.push_back(&buffer[i]);
+
+	FrameRing<Frame> ring;
+	ThreadData data = {&ring, 200000, false, 0, true};
+	pthread_t thread;
+	pthread_create(&thread, NULL, consumer, &data);
+
+	long nb_published = 0;
+	void *ptr = NULL;
+	while (nb_published < data.nb_frames) {
+		while (ring.reclaim(ptr))
+			free_list.push_back(ptr);
+		// at most the taken and the fresh frames are out
+		CHECK(int(free_list.size()) >= nb_buffers - 2);
+		long *b = (long *) free_list.back();
+		free_list.pop_back();
+		*b = nb_published;
+		ring.publish(Frame(b, nb_published++));
+	}
+	pthread_join(thread, NULL);
+
+	CHECK(data.done && data.in_order);
+	CHECK(data.nb_taken > 0);
+	while (ring.reclaim(ptr))
+		free_list.push_back(ptr);
+	CHECK(int(free_list.size()) == nb_buffers - 1);
+}
+
+int main()
+{
+	testNoConsumer();
+	testRelease();
+	testThreads();
+
+	if (nb_errors)
+		cerr << nb_errors << " error(s)" << endl;
+	return nb_errors ? 1 : 0;
+}
@@ -28,6 +28,7 @@
 #include "CtGLDisplay.h"
 #include <iostream>
 #include <iomanip>
+#include <fstream>
 
 using namespace lima;
 using namespace std;
@@ -50,6 +51,24 @@ std::vector<double> peak_angles(C_LIST_ITERS(peak_angle_list));
 
 const double TestAlternatePeriod = 5.0;
 
+// binary PPM of the RGBA frame drawn offscreen
+static bool dumpFrame(CtDirectGLDisplay *display, string file_name)
+{
+	int width, height;
+	display->getViewSize(&width, &height);
+	if ((width <= 0) || (height <= 0))
+		return false;
+	vector<unsigned char> rgba(width * height * 4);
+	if (!display->getRenderedFrame(&rgba[0], width, height))
+		return false;
+
+	ofstream os(file_name.c_str(), ios::binary);
+	os << "P6\n" << width << " " << height << "\n255\n";
+	for (int i = 0; i < width * height; ++i)
+		os.write((const char *) &rgba[i * 4], 3);
+	return os.good();
+}
+
 int main(int argc, char *argv[])
 {
 	double exp_time = 0.1;
@@ -57,12 +76,27 @@ int main(int argc, char *argv[])
 	double refresh_time = 0.01;
 
 	bool alternate_test_image = false;
+	bool direct_display = false;
+	string dump_file;
 
 	const char *spec_name = "GLDisplayTest";
 	const char *array_name = "Simulator";
 
-	if ((argc > 1) && (string(argv[1]) == "--alternate-test"))
-		alternate_test_image = true;
+	for (int i = 1; i < argc; ++i) {
+		if (string(argv[i]) == "--alternate-test")
+			alternate_test_image = true;
+		else if (string(argv[i]) == "--direct")
+			direct_display = true;
+		else if ((string(argv[i]) == "--dump") && (i < argc - 1))
+			dump_file = argv[++i];
+	}
+
+	// the last frame is saved and the program exits: the window can
+	// be drawn offscreen, with IMAGE_OFFSCREEN set
+	if (!dump_file.empty() && !direct_display) {
+		cerr << "--dump needs --direct" << endl;
+		return 1;
+	}
 
 	Simulator::Camera simu;
 	Simulator::FrameBuilder *simu_fb = simu.getFrameBuilder();
@@ -77,9 +111,18 @@ int main(int argc, char *argv[])
 	ct_acq->setAcqExpoTime(exp_time);
 	ct_acq->setAcqNbFrames(nb_frames);
 
-	CtSPSGLDisplay *ct_gl_display = new CtSPSGLDisplay(ct_control, 
-							   argc, argv);
-	ct_gl_display->setSpecArray(spec_name, array_name);
+	CtGLDisplay *ct_gl_display;
+	CtDirectGLDisplay *ct_direct_gl_display = NULL;
+	if (direct_display) {
+		ct_direct_gl_display = new CtDirectGLDisplay(ct_control, argc,
+							     argv);
+		ct_gl_display = ct_direct_gl_display;
+	} else {
+		CtSPSGLDisplay *ct_sps_gl_display;
+		ct_sps_gl_display = new CtSPSGLDisplay(ct_control, argc, argv);
+		ct_sps_gl_display->setSpecArray(spec_name, array_name);
+		ct_gl_display = ct_sps_gl_display;
+	}
 	ct_gl_display->createWindow();
 
 	ct_control->prepareAcq();
@@ -102,9 +145,40 @@ int main(int argc, char *argv[])
 		if (rates_refresh_rate.isTime()) {
 			float update, refresh;
 			ct_gl_display->getRates(&update, &refresh);
+			unsigned long displayed, skipped, acquired;
+			ct_gl_display->getFrameStats(&displayed, &skipped,
+						     &acquired);
+			unsigned long long uploaded, saved;
+			ct_gl_display->getUploadStats(&uploaded, &saved);
+			unsigned long wakeups;
+			float interval, jitter;
+			ct_gl_display->getPacingStats(&wakeups, &interval,
+						      &jitter);
 			cout << fixed << setprecision(1)
 			     << "update: " << update << ", "
-			     << "refresh: " << refresh << endl;
+			     << "refresh: " << refresh << ", "
+			     << "displayed: " << displayed << ", "
+			     << "skipped: " << skipped << ", "
+			     << "acquired: " << acquired << ", "
+			     << "uploaded MB: " << uploaded / 1e6 << ", "
+			     << "saved MB: " << saved / 1e6 << ", "
+			     << "bytes/frame: " 
+			     << (displayed ? uploaded / displayed : 0) << ", "
+			     << "wakeups: " << wakeups << ", "
+			     << "interval ms: " << interval * 1e3 << ", "
+			     << "jitter ms: " << jitter * 1e3 << endl;
+		}
+
+		if (!dump_file.empty()) {
+			CtControl::Status ct_status;
+			ct_control->getStatus(ct_status);
+			if (ct_status.AcquisitionStatus != AcqRunning) {
+				ct_gl_display->refresh();
+				if (!dumpFrame(ct_direct_gl_display, dump_file))
+					cerr << "Could not save the frame in "
+					     << dump_file << endl;
+				break;
+			}
 		}
 	}
 
@@ -25,6 +25,7 @@
 #include <unistd.h>
 #include <iostream>
 #include <string>
+#include <vector>
 #include <string.h>
 
 using namespace std;
@@ -38,6 +39,10 @@ void usage()
 	cout << endl;
 	cout << "  Options:" << endl;
 	cout << "      -f   Use forked GL display" << endl;
+	cout << "      -z   Display SPS array without copy" << endl;
+	cout << "      -a <array_name>" << endl;
+	cout << "           Also display array_name (forked only, "
+	     << "can be repeated)" << endl;
 
 	exit(1);
 }
@@ -54,11 +59,23 @@ int main(int argc, char *argv[])
 	// search options
 	double refresh_time = 0.01;
 	bool use_fork = false;
+	bool zero_copy = false;
+	vector<string> extra_arrays;
 	while ((argc > 0) && ((*argv)[0] == '-')) {
-		if (!strcmp(*argv, "-f"))
+		if (!strcmp(*argv, "-f")) {
 			use_fork = true;
+		} else if (!strcmp(*argv, "-z")) {
+			zero_copy = true;
+		} else if (!strcmp(*argv, "-a")) {
+			if (argc < 2)
+				usage();
+			argc--, argv++;
+			extra_arrays.push_back(*argv);
+		}
 		argc--, argv++;
 	}
+	if (!extra_arrays.empty() && !use_fork)
+		usage();
 	if (argc < 2)
 		usage();
 
@@ -76,6 +93,10 @@ int main(int argc, char *argv[])
 	}
 
 	sps_gl_display->setSpecArray(spec_name, array_name);
+	sps_gl_display->setZeroCopy(zero_copy);
+	for (unsigned int i = 0; i < extra_arrays.size(); ++i)
+		forked_sps_gl_display->addSpecArray(spec_name,
+						    extra_arrays[i]);
 	sps_gl_display->createWindow();
 
 	while (!sps_gl_display->isClosed()) {
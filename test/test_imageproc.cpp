@@ -0,0 +1,540 @@
+//###########################################################################
+// This file is part of gldisplay, a submodule of LImA project the
+// Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#include "imageproc.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <iostream>
+#include <vector>
+#include <limits>
+
+using namespace std;
+
+int nb_errors = 0;
+
+#define CHECK(cond)							\
+	do {								\
+		if (!(cond)) {						\
+			cerr << __FILE__ << ":" << __LINE__ << ": "	\
+			     << "check failed: " << #cond << endl;	\
+			++nb_errors;					\
+		}							\
+	} while (0)
+
+template <class T>
+void testFloat(unsigned long len)
+{
+	vector<T> buffer(len);
+	for (unsigned long i = 0; i < len; ++i)
+		buffer[i] = T(i % 1000) - 250.5;
+	// masked module gaps
+	buffer[len / 3] = NAN;
+	buffer[len / 2] = INFINITY;
+	buffer[len - 1] = -INFINITY;
+	buffer[1] = T(1e6);
+
+	double min_val, max_val;
+	CHECK(imageMinMax(&buffer[0], len, min_val, max_val));
+	CHECK(min_val == -250.5);
+	CHECK(max_val == 1e6);
+
+	vector<unsigned short> disp(len);
+	imageConvert(&buffer[0], len, -250.5, 749.5, &disp[0]);
+	for (unsigned long i = 0; i < len; ++i) {
+		T val = buffer[i];
+		unsigned short exp;
+		if (!(fabs(val) < HUGE_VAL) || (val <= -250.5))
+			exp = 0;
+		else if (val >= 749.5)
+			exp = ImageDisplayMax;
+		else
+			exp = (unsigned short) ((val + 250.5) *
+						ImageDisplayMax / 1000 + 0.5);
+		if (abs(int(disp[i]) - int(exp)) > 1) {
+			CHECK(disp[i] == exp);
+			break;
+		}
+	}
+
+	for (unsigned long i = 0; i < len; ++i)
+		buffer[i] = NAN;
+	CHECK(!imageMinMax(&buffer[0], len, min_val, max_val));
+}
+
+template <class T>
+void testInt(T min_exp, T max_exp)
+{
+	const unsigned long len = 1001;
+	vector<T> buffer(len, T(min_exp / 2 + max_exp / 2));
+	buffer[len / 2] = min_exp;
+	buffer[len - 1] = max_exp;
+
+	double min_val, max_val;
+	CHECK(imageMinMax(&buffer[0], len, min_val, max_val));
+	CHECK(min_val == double(min_exp));
+	CHECK(max_val == double(max_exp));
+	CHECK(!imageMinMax(&buffer[0], 0, min_val, max_val));
+}
+
+// every vector path must match the scalar loop, with the extrema in the
+// first/last vector block and in the scalar tail
+template <class T>
+void testIntSimd(unsigned long len)
+{
+	vector<T> buffer(len);
+	for (unsigned long i = 0; i < len; ++i)
+		buffer[i] = T(i * 2654435761U >> 7);
+
+	for (unsigned long pos = 0; pos < len; pos += len / 3 + 1) {
+		vector<T> data(buffer);
+		data[pos] = numeric_limits<T>::min();
+		data[len - 1 - pos] = numeric_limits<T>::max();
+
+		double min_exp, max_exp;
+		imageSetSimd(ImageSimdNone);
+		CHECK(imageMinMax(&data[0], len, min_exp, max_exp));
+		CHECK(min_exp == double(numeric_limits<T>::min()));
+		CHECK(max_exp == double(numeric_limits<T>::max()));
+		for (int simd = ImageSimdSse2; simd <= ImageSimdAvx2; ++simd) {
+			imageSetSimd(simd);
+			double min_val, max_val;
+			CHECK(imageMinMax(&data[0], len, min_val, max_val));
+			CHECK(min_val == min_exp);
+			CHECK(max_val == max_exp);
+		}
+	}
+	imageSetSimd(ImageSimdAvx2);
+}
+
+// frames split in bands must give the same result as a single thread
+template <class T>
+void testBands(unsigned long len)
+{
+	vector<T> buffer(len);
+	for (unsigned long i = 0; i < len; ++i)
+		buffer[i] = T(i % 1000) - T(200);
+	buffer[len - 1] = T(5000);
+	buffer[len / 3] = T(-700);
+
+	double min_exp, max_exp;
+	vector<unsigned short> disp_exp(len), disp(len);
+	imageSetThreads(1);
+	CHECK(imageMinMax(&buffer[0], len, min_exp, max_exp));
+	CHECK(min_exp == -700);
+	CHECK(max_exp == 5000);
+	imageConvert(&buffer[0], len, -100, 300, &disp_exp[0]);
+
+	for (int nr_threads = 2; nr_threads <= 5; ++nr_threads) {
+		CHECK(imageSetThreads(nr_threads) == nr_threads);
+		double min_val, max_val;
+		CHECK(imageMinMax(&buffer[0], len, min_val, max_val));
+		CHECK(min_val == min_exp);
+		CHECK(max_val == max_exp);
+		imageConvert(&buffer[0], len, -100, 300, &disp[0]);
+		CHECK(disp == disp_exp);
+	}
+	imageSetThreads(0);
+}
+
+// one hot and one dead pixel must not move the percentiles
+template <class T>
+void testHistogram(unsigned long len, bool exact)
+{
+	vector<T> buffer(len);
+	for (unsigned long i = 0; i < len; ++i)
+		buffer[i] = T(i % 100 + 10);
+	buffer[len / 2] = T(120);
+	buffer[len - 1] = T(0);
+
+	ImageHistogram hist;
+	CHECK(imageHistogram(&buffer[0], len, hist));
+	CHECK(hist.exact == exact);
+	CHECK(hist.nr_pixels == len);
+	CHECK(hist.min_val == 0);
+	CHECK(hist.max_val == 120);
+	CHECK(imageHistPercentile(hist, 0) == 0);
+	CHECK(imageHistPercentile(hist, 1) == 120);
+	// the outliers shift the ranks by at most one value
+	double tol = 1 + (exact ? 0 : hist.bin_width);
+	CHECK(fabs(imageHistPercentile(hist, 0.01) - 10) <= tol);
+	CHECK(fabs(imageHistPercentile(hist, 0.5) - 59.5) <= tol);
+	CHECK(fabs(imageHistPercentile(hist, 0.99) - 108.5) <= tol);
+
+	CHECK(!imageHistogram(&buffer[0], 0, hist));
+	CHECK(imageHistPercentile(hist, 0.5) == 0);
+}
+
+void testHistogramWide()
+{
+	// 32-bit of wide range get ImageHistBins bins
+	vector<unsigned int> buffer(1000, 7);
+	buffer[10] = 4000000000U;
+	ImageHistogram hist;
+	CHECK(imageHistogram(&buffer[0], buffer.size(), hist));
+	CHECK(!hist.exact);
+	CHECK(hist.bins.size() == ImageHistBins);
+	CHECK(hist.bins[0] == 999);
+	CHECK(hist.bins[ImageHistBins - 1] == 1);
+	CHECK(fabs(imageHistPercentile(hist, 0.99) - 7) <= hist.bin_width);
+
+	// NaN/Inf are not counted
+	vector<float> fbuffer(1000, 1.5);
+	fbuffer[1] = NAN;
+	fbuffer[2] = INFINITY;
+	CHECK(imageHistogram(&fbuffer[0], fbuffer.size(), hist));
+	CHECK(hist.nr_pixels == 998);
+	CHECK(imageHistPercentile(hist, 0.3) == 1.5);
+	fbuffer.assign(10, NAN);
+	CHECK(!imageHistogram(&fbuffer[0], fbuffer.size(), hist));
+}
+
+// fraction of the pixels below val must be within the bound of the
+// percentile estimated from samples. In a frame of columns, strided
+// samples would all fall in the same column
+void testSampleHistogram(int width, int height, unsigned long nr_samples)
+{
+	unsigned long len = (unsigned long) width * height;
+	vector<unsigned short> buffer(len);
+	for (unsigned long i = 0; i < len; ++i)
+		buffer[i] = (unsigned short) (i % width);
+	buffer[len / 2] = 65535;
+
+	ImageHistogram exact, hist;
+	CHECK(imageHistogram(&buffer[0], len, exact));
+	CHECK(imageSampleHistogram(&buffer[0], len, nr_samples, hist));
+	CHECK(hist.nr_pixels == nr_samples);
+
+	double error = imageSampleError(nr_samples);
+	for (double fraction = 0.01; fraction < 1; fraction += 0.07) {
+		int val = int(imageHistPercentile(hist, fraction));
+		unsigned long below = 0;
+		for (int i = 0; i < val; ++i)
+			below += exact.bins[i];
+		double low = double(below) / len;
+		double high = double(below + exact.bins[val]) / len;
+		CHECK((fraction > low - error) && (fraction < high + error));
+	}
+
+	// a budget larger than the frame counts all the pixels
+	CHECK(imageSampleHistogram(&buffer[0], len, len, hist));
+	CHECK(hist.bins == exact.bins);
+	CHECK(fabs(imageSampleError(65536) - 0.0064) < 0.0001);
+}
+
+template <class T>
+void testSubsample(int width, int height, int step)
+{
+	vector<T> buffer(width * height);
+	for (int i = 0; i < width * height; ++i)
+		buffer[i] = T(i);
+
+	int dst_width = (width + step - 1) / step;
+	int dst_height = (height + step - 1) / step;
+	vector<T> disp(dst_width * dst_height);
+	imageSubsample(&buffer[0], width, height, sizeof(T), step, &disp[0]);
+	for (int i = 0; i < dst_height; ++i) {
+		for (int j = 0; j < dst_width; ++j) {
+			T val = disp[i * dst_width + j];
+			if (val != buffer[i * step * width + j * step]) {
+				CHECK(val == buffer[i * step * width + 
+						    j * step]);
+				return;
+			}
+		}
+	}
+}
+
+template <class T>
+void testDecimate(int width, int height, int step)
+{
+	vector<T> buffer(width * height);
+	for (int i = 0; i < width * height; ++i)
+		buffer[i] = T((unsigned long) i * 7919 % 101);
+	// hot pixel
+	buffer[(height / 2) * width + width / 2] = T(120);
+
+	// on the partial edge blocks
+	buffer[width * height - 1] = T(110);
+
+	int dst_width = (width + step - 1) / step;
+	int dst_height = (height + step - 1) / step;
+	vector<T> disp(dst_width * dst_height);
+	imageDecimateMax(&buffer[0], width, height, step, &disp[0]);
+	bool hot_found = false;
+	for (int i = 0; i < dst_height; ++i) {
+		for (int j = 0; j < dst_width; ++j) {
+			T exp = buffer[i * step * width + j * step];
+			for (int k = i * step; k < min(i * step + step, height);
+			     ++k)
+				for (int l = j * step; 
+				     l < min(j * step + step, width); ++l)
+					exp = max(exp, buffer[k * width + l]);
+			T val = disp[i * dst_width + j];
+			if (val != exp) {
+				CHECK(val == exp);
+				return;
+			}
+			if (val == T(120))
+				hot_found = true;
+		}
+	}
+	CHECK(hot_found);
+	CHECK(disp[dst_width * dst_height - 1] == T(110));
+}
+
+template <class T>
+void testDecimateFloat()
+{
+	const int width = 37, height = 9, step = 3;
+	vector<T> buffer(width * height, T(-5));
+	buffer[0] = NAN;
+	buffer[width + 1] = INFINITY;
+	buffer[2 * width + 2] = T(1.5);
+	for (int i = 0; i < 3; ++i)
+		for (int j = 3; j < 6; ++j)
+			buffer[i * width + j] = NAN;
+
+	vector<T> disp(((width + step - 1) / step) * (height / step));
+	imageDecimateMax(&buffer[0], width, height, step, &disp[0]);
+	CHECK(disp[0] == T(1.5));
+	CHECK(disp[1] == -INFINITY);
+	CHECK(disp[2] == T(-5));
+	CHECK(disp[12] == T(-5));
+}
+
+// a sub-rectangle of a larger frame, odd sizes give 1-pixel blocks
+template <class T>
+void testReduce(int width, int height, bool use_max)
+{
+	const int stride = width + 3;
+	vector<T> buffer(stride * height);
+	for (int i = 0; i < stride * height; ++i)
+		buffer[i] = T((unsigned long) i * 7919 % 101);
+
+	int dst_width = (width + 1) / 2, dst_height = (height + 1) / 2;
+	const int dst_stride = dst_width + 1;
+	vector<T> disp(dst_stride * dst_height, T(7));
+	imageReduce(&buffer[0], width, height, stride, use_max, &disp[0],
+		    dst_stride);
+	for (int i = 0; i < dst_height; ++i) {
+		for (int j = 0; j < dst_width; ++j) {
+			double sum = 0, exp = 0;
+			int n = 0;
+			for (int k = 2 * i; k < min(2 * i + 2, height); ++k)
+				for (int l = 2 * j; l < min(2 * j + 2, width);
+				     ++l) {
+					double v = buffer[k * stride + l];
+					exp = n ? max(exp, v) : v;
+					sum += v;
+					++n;
+				}
+			if (!use_max) {
+				exp = sum / n;
+				if (numeric_limits<T>::is_integer)
+					exp = floor(exp + 0.5);
+			}
+			T val = disp[i * dst_stride + j];
+			if (val != T(exp)) {
+				CHECK(val == T(exp));
+				return;
+			}
+		}
+		CHECK(disp[i * dst_stride + dst_width] == T(7));
+	}
+}
+
+template <class T>
+void testReduceFloat()
+{
+	T buffer[2 * 4] = {NAN, T(1), INFINITY, NAN,
+			   T(3), T(-2), NAN, NAN};
+	T disp[2];
+	imageReduce(buffer, 4, 2, 4, false, disp, 2);
+	CHECK(disp[0] == T(2) / 3);
+	CHECK(disp[1] == -INFINITY);
+	imageReduce(buffer, 4, 2, 4, true, disp, 2);
+	CHECK(disp[0] == T(3));
+	CHECK(disp[1] == -INFINITY);
+}
+
+template <class T>
+void testColormap(int width, int height, int dst_width, int dst_height,
+		  int offset)
+{
+	vector<T> buffer(width * height);
+	for (int i = 0; i < width * height; ++i)
+		buffer[i] = T(i % 300 - offset);
+	if (numeric_limits<T>::has_quiet_NaN) {
+		buffer[0] = numeric_limits<T>::quiet_NaN();
+		buffer[1] = numeric_limits<T>::infinity();
+	}
+
+	unsigned int lut[ImageLutSize];
+	for (int i = 0; i < ImageLutSize; ++i)
+		lut[i] = 1000 + i;
+
+	// [0, 256] maps each integer value to its own entry
+	const int stride = dst_width + 3, sentinel = 7;
+	vector<unsigned int> disp(stride * dst_height, sentinel);
+	imageColormap(&buffer[0], width, height, 0, ImageLutSize, lut,
+		      &disp[0], dst_width, dst_height, stride);
+	for (int i = 0; i < dst_height; ++i) {
+		for (int j = 0; j < stride; ++j) {
+			unsigned int val = disp[i * stride + j];
+			unsigned int exp = sentinel;
+			if (j < dst_width) {
+				int row = i * height / dst_height;
+				int col = j * width / dst_width;
+				double v = buffer[row * width + col];
+				int idx = 0;
+				if (fabs(v) < HUGE_VAL)
+					idx = int(min(max(v, 0.0), 255.0));
+				exp = lut[idx];
+			}
+			if (val != exp) {
+				CHECK(val == exp);
+				return;
+			}
+		}
+	}
+}
+
+void testHash(int row_bytes, int nr_rows)
+{
+	const long stride = row_bytes + 5;
+	vector<unsigned char> buffer(stride * nr_rows);
+	for (unsigned long i = 0; i < buffer.size(); ++i)
+		buffer[i] = (unsigned char) (i * 7919 % 251);
+
+	unsigned long long hash = imageHash(&buffer[0], row_bytes, nr_rows,
+					    stride);
+	CHECK(imageHash(&buffer[0], row_bytes, nr_rows, stride) == hash);
+
+	// any changed byte in the rows is detected, the gaps are ignored
+	for (long i = 0; i < stride * nr_rows; ++i) {
+		unsigned char orig = buffer[i];
+		buffer[i] ^= 0x80;
+		bool in_row = (i % stride < row_bytes);
+		bool changed = (imageHash(&buffer[0], row_bytes, nr_rows, 
+					  stride) != hash);
+		buffer[i] = orig;
+		if (changed != in_row) {
+			CHECK(changed == in_row);
+			return;
+		}
+	}
+}
+
+int main()
+{
+	// signed values must not wrap around
+	testInt<signed char>(-128, 127);
+	testInt<short>(-32768, 32767);
+	testInt<int>(-2147483647 - 1, 2147483647);
+	testInt<unsigned char>(0, 255);
+	testInt<unsigned short>(0, 65535);
+	testInt<unsigned int>(0, 4294967295U);
+	testInt<short>(-300, -5);
+
+	// SIMD paths, lengths around the vector block sizes
+	testIntSimd<unsigned char>(1000003);
+	testIntSimd<signed char>(65);
+	testIntSimd<unsigned short>(4099);
+	testIntSimd<short>(31);
+	testIntSimd<unsigned int>(1027);
+	testIntSimd<int>(17);
+	testIntSimd<unsigned char>(2);
+
+	// large frames run in bands
+	testBands<float>(3000017);
+	testBands<double>(2100000);
+
+	// percentiles
+	testHistogram<unsigned char>(1001, true);
+	testHistogram<signed char>(1001, true);
+	testHistogram<unsigned short>(100003, true);
+	testHistogram<short>(1001, true);
+	testHistogram<unsigned int>(1001, true);
+	testHistogram<int>(1200000, true);
+	testHistogram<float>(1200000, false);
+	testHistogram<double>(1001, false);
+	testHistogramWide();
+	testSampleHistogram(1024, 1024, 1024);
+	testSampleHistogram(2048, 1000, 65536);
+	testSampleHistogram(1000, 1, 10);
+
+	// odd lengths exercise the scalar tails
+	testFloat<float>(1027);
+	testFloat<double>(1027);
+	testFloat<float>(5);
+	testFloat<double>(3);
+
+	// frames larger than the window, borders are dropped
+	testSubsample<unsigned char>(101, 67, 4);
+	testSubsample<unsigned short>(1024, 1024, 8);
+	testSubsample<float>(33, 35, 3);
+	testSubsample<double>(10, 10, 1);
+
+	// max-pooling keeps the hot pixels, large frames run in bands
+	testDecimate<unsigned char>(101, 67, 4);
+	testDecimate<signed char>(67, 101, 3);
+	testDecimate<unsigned short>(2048, 1024, 8);
+	testDecimate<short>(333, 129, 2);
+	testDecimate<unsigned int>(64, 64, 5);
+	testDecimate<int>(1024, 1024, 16);
+	testDecimate<float>(1030, 1030, 4);
+	testDecimate<double>(99, 99, 1);
+	testDecimateFloat<float>();
+	testDecimateFloat<double>();
+
+	// pyramid levels
+	testReduce<unsigned char>(101, 67, true);
+	testReduce<signed char>(67, 101, false);
+	testReduce<unsigned short>(512, 512, true);
+	testReduce<short>(333, 129, false);
+	testReduce<unsigned int>(64, 63, false);
+	testReduce<int>(1024, 1024, true);
+	testReduce<float>(1030, 1031, false);
+	testReduce<double>(1, 1, true);
+	testReduceFloat<float>();
+	testReduceFloat<double>();
+
+	// scaled down and up, NaN/Inf get the first entry
+	testColormap<unsigned char>(37, 11, 20, 7, 0);
+	testColormap<unsigned short>(100, 100, 333, 250, 0);
+	testColormap<unsigned int>(1030, 1030, 700, 700, 0);
+	testColormap<signed char>(37, 11, 37, 11, 20);
+	testColormap<short>(64, 64, 17, 5, 20);
+	testColormap<int>(64, 64, 17, 5, 20);
+	testColormap<float>(101, 33, 50, 16, 20);
+	testColormap<double>(33, 101, 5, 50, 20);
+
+	// tile rows of a larger frame: full lanes, words and byte tails
+	testHash(70, 3);
+	testHash(7, 4);
+	testHash(1024, 2);
+
+	if (nb_errors)
+		cerr << nb_errors << " error(s)" << endl;
+	return nb_errors ? 1 : 0;
+}